@@ -0,0 +1,207 @@
+#include "../headers/thread.h"
+#include "../headers/tracer.h"
+
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <thread>
+
+// Renders a scene without SDL, ImGui or a window and writes the image to disk, for
+// headless render boxes and offline throughput runs. Tiles go through the same
+// ThreadManager and the same render / pcg_render / wavefront_render kernels as the
+// interactive modes, and the frames are accumulated and resolved the same way.
+//
+// usage: raysdl-batch [--scene scene1|random:N] [--width W] [--height H] [--spp N]
+//                     [--depth N] [--rr-depth N] [--frames N] [--threads N]
+//                     [--mode regular|pcg|wavefront] [--sampler white|sobol|lattice|blue-noise]
+//                     [--out image.ppm|image.pfm]
+
+struct BatchOptions {
+    std::string scene = "scene1";
+    int width = 1000;
+    int height = 562;
+    int spp = 16;
+    int depth = 50;
+    int rr_depth = 3;
+    int frames = 1;
+    int threads = std::thread::hardware_concurrency();
+    std::string mode = "pcg";
+    sampler_type sampler = sampler_type::white;
+    std::string out = "out.ppm";
+};
+
+void usage(const char *name) {
+    fprintf(stderr,
+        "usage: %s [--scene scene1|random:N] [--width W] [--height H] [--spp N]\n"
+        "          [--depth N] [--rr-depth N] [--frames N] [--threads N]\n"
+        "          [--mode regular|pcg|wavefront] [--sampler white|sobol|lattice|blue-noise]\n"
+        "          [--out image.ppm|image.pfm]\n", name);
+    exit(1);
+}
+
+sampler_type parse_sampler(const char *value, const char *name) {
+    for (int i = 0; i < SAMPLER_TYPE_COUNT; i++) {
+        if (strcmp(value, sampler_name(static_cast<sampler_type>(i))) == 0)
+            return static_cast<sampler_type>(i);
+    }
+    usage(name);
+    return sampler_type::white;
+}
+
+// Sphere count of a random:N scene name, or 0 when N is not a whole number
+int random_scene_size(const std::string &name) {
+    const char *digits = name.c_str() + strlen("random:");
+    char *end = nullptr;
+    long count = strtol(digits, &end, 10);
+    if (end == digits || *end != '\0' || count < 0 || count > INT_MAX)
+        return 0;
+    return static_cast<int>(count);
+}
+
+BatchOptions parse_options(int argc, char **argv) {
+    BatchOptions options;
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 >= argc)
+            usage(argv[0]);
+        std::string key = argv[i];
+        const char *value = argv[++i];
+
+        if (key == "--scene")         options.scene = value;
+        else if (key == "--width")    options.width = atoi(value);
+        else if (key == "--height")   options.height = atoi(value);
+        else if (key == "--spp")      options.spp = atoi(value);
+        else if (key == "--depth")    options.depth = atoi(value);
+        else if (key == "--rr-depth") options.rr_depth = atoi(value);
+        else if (key == "--frames")   options.frames = atoi(value);
+        else if (key == "--threads")  options.threads = atoi(value);
+        else if (key == "--mode")     options.mode = value;
+        else if (key == "--sampler")  options.sampler = parse_sampler(value, argv[0]);
+        else if (key == "--out")      options.out = value;
+        else usage(argv[0]);
+    }
+
+    if (options.width < 2 || options.height < 2 || options.spp < 1 || options.depth < 1 ||
+        options.frames < 1 || options.threads < 1)
+        usage(argv[0]);
+    if (options.mode != "regular" && options.mode != "pcg" && options.mode != "wavefront")
+        usage(argv[0]);
+    if (options.scene.rfind("random:", 0) == 0 && random_scene_size(options.scene) < 1)
+        usage(argv[0]);
+    return options;
+}
+
+bool load_scene(Scene &scene, const std::string &name) {
+    if (name == "scene1") {
+        scene.init_scene1();
+        return true;
+    }
+    if (name.rfind("random:", 0) == 0) {
+        scene.init_benchmark_scene(random_scene_size(name));
+        return true;
+    }
+    return false;
+}
+
+// 8-bit sRGB-ish PPM straight from the packed pixels, which hold r, g, b in the low bytes
+bool write_ppm(const char *path, const uint *pixels, int width, int height) {
+    FILE *file = fopen(path, "wb");
+    if (!file)
+        return false;
+
+    fprintf(file, "P6\n%d %d\n255\n", width, height);
+    for (int n = 0; n < width * height; n++) {
+        unsigned char rgb[3] = {
+            static_cast<unsigned char>(pixels[n]),
+            static_cast<unsigned char>(pixels[n] >> 8),
+            static_cast<unsigned char>(pixels[n] >> 16),
+        };
+        fwrite(rgb, 1, 3, file);
+    }
+    return fclose(file) == 0;
+}
+
+// Linear HDR PFM of the accumulated average. PFM rows run bottom to top and a
+// negative scale marks the floats as little-endian.
+bool write_pfm(const char *path, const color *accum, int samples, int width, int height) {
+    FILE *file = fopen(path, "wb");
+    if (!file)
+        return false;
+
+    fprintf(file, "PF\n%d %d\n-1.0\n", width, height);
+    for (int y = height - 1; y >= 0; y--) {
+        for (int x = 0; x < width; x++) {
+            color c = accum[y * width + x] / samples;
+            float rgb[3] = { c.x, c.y, c.z };
+            fwrite(rgb, sizeof(float), 3, file);
+        }
+    }
+    return fclose(file) == 0;
+}
+
+int main(int argc, char **argv) {
+    BatchOptions options = parse_options(argc, argv);
+
+    Scene scene;
+    if (!load_scene(scene, options.scene)) {
+        fprintf(stderr, "unknown scene: %s\n", options.scene.c_str());
+        return 1;
+    }
+
+    camera cam(static_cast<simd::float1>(options.width) / options.height);
+    Parameters params(options.width, options.height);
+    params.samples_per_pixel = options.spp;
+    params.max_depth = options.depth;
+    params.rr_depth = options.rr_depth;
+    params.sampler = options.sampler;
+    prepare_sampler(params.sampler);
+    params.pack_target = params.buffer;
+    params.pack_pitch = options.width;
+
+    std::function<void(Scene&, camera&, Parameters&, RenderTask)> kernel = pcg_render;
+    if (options.mode == "regular")
+        kernel = render;
+    else if (options.mode == "wavefront")
+        kernel = wavefront_render;
+
+    ThreadManager threads(options.width, options.height, options.threads);
+    threads.threads_init([&](const RenderTask &task) {
+        kernel(scene, cam, params, task);
+        resolve_tile(params, task);
+    });
+
+    printf("%s, %dx%d, %d spp x %d frames, depth %d, %s with %s samples on %d threads\n",
+        options.scene.c_str(), options.width, options.height, options.spp, options.frames,
+        options.depth, options.mode.c_str(), sampler_name(options.sampler), options.threads);
+
+    uint64_t rays = 0;
+    auto start = NOW();
+    for (int f = 0; f < options.frames; f++) {
+        params.ray_stats.reset();
+        threads.push_tasks();
+        threads.wait_for_completion();
+
+        rays += params.ray_stats.primary_rays + params.ray_stats.secondary_rays;
+        params.accumulated_frames++;
+        params.accumulated_samples += params.samples_per_pixel;
+    }
+    double seconds = GET_TIME(NOW(), start);
+
+    printf("wall time: %.3f s\n", seconds);
+    printf("rays:      %llu (%.2f Mrays/s)\n", static_cast<unsigned long long>(rays), rays / seconds * 1e-6);
+
+    const std::string &out = options.out;
+    bool pfm = out.size() >= 4 && out.compare(out.size() - 4, 4, ".pfm") == 0;
+    bool written = pfm
+        ? write_pfm(out.c_str(), params.accum_buffer, params.accumulated_samples, options.width, options.height)
+        : write_ppm(out.c_str(), params.buffer, options.width, options.height);
+    if (!written) {
+        fprintf(stderr, "failed to write %s\n", out.c_str());
+        return 1;
+    }
+    printf("wrote %s\n", out.c_str());
+    return 0;
+}
@@ -0,0 +1,186 @@
+#include "../headers/hittable_list.h"
+#include "../headers/camera.h"
+#include "../headers/sphere_soa.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+// Traces the same camera rays through the linear hittable_list scan, the packed
+// sphere_soa scan, the binary SAH BVH and its four-wide collapse for random sphere
+// scenes of increasing size, then drags one sphere around the scene to time
+// incremental refits. Node visits per ray are only counted when built with BVH_STATS.
+//
+// usage: bvh_bench [sphere_count ...]
+
+const auto BENCH_ASPECT = 16.0 / 9.0;
+
+struct TraceResult {
+    double ns_per_ray;
+    double nodes_per_ray;
+    int hits;
+};
+
+std::vector<ray> camera_rays(const camera& cam, int count) {
+    std::vector<ray> rays;
+    rays.reserve(count);
+
+    simd::uint1 seed = 7;
+    for (int i = 0; i < count; i++) {
+        rays.push_back(cam.get_ray(pcg_random_float(seed), pcg_random_float(seed)));
+    }
+    return rays;
+}
+
+struct RefitResult {
+    double mean_us;
+    double max_us;
+};
+
+// Walks the controlled sphere across the scene the way handle_inputs does
+RefitResult drag_controlled(Scene& scene, int steps) {
+    auto controlled = std::static_pointer_cast<sphere>(scene.controlled);
+    double total = 0, worst = 0;
+
+    for (int i = 0; i < steps; i++) {
+        controlled->center[0] += 0.02;
+        controlled->center[2] -= 0.01;
+
+        auto start = NOW();
+        scene.world.refit(controlled.get());
+        double us = GET_TIME(NOW(), start) * 1e6;
+
+        total += us;
+        worst = std::max(worst, us);
+    }
+    return RefitResult { total / steps, worst };
+}
+
+// Walks the controlled sphere around in random steps, far enough to degrade nodes and
+// force subtree rebuilds, and after each refit casts a ray down onto it through the tree and through
+// every object in turn. Returns how many of those rays the two disagreed on.
+int check_refits(Scene& scene, int steps) {
+    auto controlled = std::static_pointer_cast<sphere>(scene.controlled);
+    simd::uint1 seed = 11;
+    int mismatches = 0;
+
+    for (int i = 0; i < steps; i++) {
+        // Steps big enough to degrade a subtree now and then but rarely the root
+        controlled->center[0] += pcg_random_float(seed, -1, 1);
+        controlled->center[2] += pcg_random_float(seed, -1, 1);
+        scene.world.refit(controlled.get());
+
+        // Just above the field: from much further away sphere::hit loses too much precision
+        // to serve as the reference
+        ray down(simd::make_float3(controlled->center[0], 3, controlled->center[2]), simd::make_float3(0, -1, 0));
+        hit_record rec, closest;
+        bool tree_hit = scene.world.hit(down, 0.001, infinity, rec);
+
+        bool list_hit = false;
+        simd::float1 t_max = infinity;
+        for (const auto& object : scene.world.objects) {
+            if (object->hit(down, 0.001, t_max, closest)) {
+                list_hit = true;
+                t_max = closest.t;
+            }
+        }
+        if (tree_hit != list_hit || (tree_hit && rec.t != closest.t))
+            mismatches++;
+    }
+    return mismatches;
+}
+
+TraceResult trace(const hittable& world, const std::vector<ray>& rays, size_t count) {
+    hit_record rec;
+    int hits = 0;
+
+#ifdef BVH_STATS
+    bvh_stats = bvh_counters();
+#endif
+    auto start = NOW();
+    for (size_t i = 0; i < count; i++) {
+        if (world.hit(rays[i], 0.001, infinity, rec))
+            hits++;
+    }
+    double seconds = GET_TIME(NOW(), start);
+
+    double nodes_per_ray = 0;
+#ifdef BVH_STATS
+    nodes_per_ray = static_cast<double>(bvh_stats.node_visits) / count;
+#endif
+    return TraceResult { seconds * 1e9 / count, nodes_per_ray, hits };
+}
+
+int main(int argc, char **argv) {
+    std::vector<int> sphere_counts;
+    for (int i = 1; i < argc; i++)
+        sphere_counts.push_back(atoi(argv[i]));
+    if (sphere_counts.empty())
+        sphere_counts = { 10000, 100000, 1000000 };
+
+    camera cam(BENCH_ASPECT);
+    const int bvh_rays = 1 << 18;
+    std::vector<ray> rays = camera_rays(cam, bvh_rays);
+    bool failed = false;
+
+    for (int count : sphere_counts) {
+        Scene scene;
+        scene.world.use_wide_bvh = false;
+        scene.init_benchmark_scene(count);
+
+        auto build_start = NOW();
+        scene.world.build_bvh();
+        double build_ms = GET_TIME(NOW(), build_start) * 1e3;
+
+        // The linear scans get a budget of ~2^28 sphere tests so the big scenes finish
+        size_t list_rays = std::max<size_t>(64, std::min<size_t>(bvh_rays, (1u << 28) / scene.world.objects.size()));
+
+        RefitResult refit = drag_controlled(scene, 1000);
+        TraceResult bvh2 = trace(scene.world, rays, bvh_rays);
+
+        scene.world.use_wide_bvh = true;
+        auto collapse_start = NOW();
+        scene.world.build_bvh();
+        double collapse_ms = GET_TIME(NOW(), collapse_start) * 1e3;
+
+        RefitResult refit4 = drag_controlled(scene, 1000);
+        int wide_mismatches = check_refits(scene, 400);
+        scene.world.use_wide_bvh = false;
+        scene.world.build_bvh();
+        int binary_mismatches = check_refits(scene, 400);
+        scene.world.use_wide_bvh = true;
+        scene.world.build_bvh();
+        if (wide_mismatches || binary_mismatches) {
+            failed = true;
+            fprintf(stderr, "refit mismatch at %d spheres: bvh2 missed %d of 400 rays, bvh4 %d\n",
+                count, binary_mismatches, wide_mismatches);
+        }
+        TraceResult bvh4 = trace(scene.world, rays, bvh_rays);
+        TraceResult bvh4_subset = trace(scene.world, rays, list_rays);
+
+        scene.world.clear_bvh();
+        TraceResult list = trace(scene.world, rays, list_rays);
+
+        sphere_soa packed;
+        for (const auto& object : scene.world.objects)
+            packed.add(*std::static_pointer_cast<sphere>(object));
+        TraceResult soa = trace(packed, rays, list_rays);
+
+        if (list.hits != bvh4_subset.hits || list.hits != soa.hits) {
+            failed = true;
+            fprintf(stderr, "mismatch at %d spheres: list hit %d rays, soa hit %d, bvh hit %d\n",
+                count, list.hits, soa.hits, bvh4_subset.hits);
+        }
+
+        printf("%d spheres (bvh build %.1f ms, binary + wide %.1f ms)\n", count, build_ms, collapse_ms);
+        printf("  %-6s %12.1f ns/ray\n", "list", list.ns_per_ray);
+        printf("  %-6s %12.1f ns/ray\n", "soa", soa.ns_per_ray);
+        printf("  %-6s %12.1f ns/ray %8.1fx list %8.1f nodes/ray   refit mean %.1f us, max %.1f us\n",
+            "bvh2", bvh2.ns_per_ray, list.ns_per_ray / bvh2.ns_per_ray, bvh2.nodes_per_ray, refit.mean_us, refit.max_us);
+        printf("  %-6s %12.1f ns/ray %8.1fx list %8.1f nodes/ray   refit mean %.1f us, max %.1f us\n",
+            "bvh4", bvh4.ns_per_ray, list.ns_per_ray / bvh4.ns_per_ray, bvh4.nodes_per_ray, refit4.mean_us, refit4.max_us);
+    }
+
+    return failed ? 1 : 0;
+}
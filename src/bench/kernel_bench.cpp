@@ -0,0 +1,246 @@
+#include "../headers/hittable_list.h"
+#include "../headers/camera.h"
+#include "../headers/material.h"
+#include "../headers/color.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <vector>
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+// Times the innermost kernels one at a time over fixed, pre-generated inputs:
+// sphere and scene intersection, the PCG generator and sphere sampler (one value
+// at a time and a vector's worth at a time), both material scatters, camera rays
+// and the two color packers. Each kernel is warmed up, calibrated to batches of
+// about 20 ms and then timed over `repetitions` batches; the median, fastest and
+// spread of those batches are reported in ns per call along with millions of
+// calls per second. Passing a CPU pins the benchmark
+// to that core (Linux only) to keep migrations and frequency changes out of it.
+//
+// usage: kernel_bench [repetitions] [cpu]
+
+const auto BENCH_ASPECT = 16.0 / 9.0;
+const int INPUT_COUNT = 4096;
+
+// Keeps the compiler from discarding a result it can see is never used
+template<typename T>
+inline void keep(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+struct KernelResult {
+    double median_ns;
+    double min_ns;
+    double spread;
+};
+
+// `batch(n)` runs the kernel n times. The batch size is doubled until one batch
+// takes long enough to time reliably, after a warmup of roughly 100 ms.
+KernelResult time_kernel(const std::function<void(size_t)>& batch, int repetitions) {
+    size_t n = 64;
+    while (true) {
+        auto start = NOW();
+        batch(n);
+        if (GET_TIME(NOW(), start) > 0.02)
+            break;
+        n *= 2;
+    }
+    for (auto warmup = NOW(); GET_TIME(NOW(), warmup) < 0.1; )
+        batch(n);
+
+    std::vector<double> ns;
+    for (int r = 0; r < repetitions; r++) {
+        auto start = NOW();
+        batch(n);
+        ns.push_back(GET_TIME(NOW(), start) * 1e9 / n);
+    }
+
+    std::sort(ns.begin(), ns.end());
+    double mean = 0, variance = 0;
+    for (double t : ns)
+        mean += t / ns.size();
+    for (double t : ns)
+        variance += (t - mean) * (t - mean) / ns.size();
+    return KernelResult { ns[ns.size() / 2], ns.front(), std::sqrt(variance) / mean };
+}
+
+void report(const char *name, const KernelResult& result) {
+    printf("%-28s %10.2f %10.2f %9.1f%% %12.1f\n",
+        name, result.median_ns, result.min_ns, 100 * result.spread, 1e3 / result.median_ns);
+}
+
+bool pin_to_cpu(int cpu) {
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
+
+int main(int argc, char **argv) {
+    int repetitions = argc > 1 ? std::max(1, atoi(argv[1])) : 15;
+    int cpu = argc > 2 ? atoi(argv[2]) : -1;
+
+    if (cpu >= 0 && !pin_to_cpu(cpu))
+        fprintf(stderr, "could not pin to cpu %d, running unpinned\n", cpu);
+
+    // Inputs shared by every kernel, generated once from fixed seeds
+    Scene scene;
+    scene.init_benchmark_scene(1000);
+    camera cam(BENCH_ASPECT);
+
+    simd::uint1 seed = 7;
+    std::vector<float> us(INPUT_COUNT), vs(INPUT_COUNT);
+    std::vector<ray> rays;
+    std::vector<hit_record> hits;
+    std::vector<color> pixels(INPUT_COUNT);
+    std::vector<uint> packed(INPUT_COUNT);
+    for (int i = 0; i < INPUT_COUNT; i++) {
+        us[i] = pcg_random_float(seed);
+        vs[i] = pcg_random_float(seed);
+        rays.push_back(cam.get_ray(us[i], vs[i]));
+        pixels[i] = 4 * pcg_random3(seed);
+
+        hit_record rec;
+        if (scene.world.hit(rays[i], 0.001, infinity, rec))
+            hits.push_back(rec);
+    }
+
+    sphere target(simd::make_float3(0, 0, -1.5), 0.75, 0);
+    lambertian diffuse(simd::make_float3(0.5, 0.5, 0.5));
+    metal mirror(simd::make_float3(0.8, 0.8, 0.8));
+    const material *diffuse_material = &diffuse;
+    const material *metal_material = &mirror;
+
+    printf("%zu hit records from %d camera rays, %d repetitions%s\n",
+        hits.size(), INPUT_COUNT, repetitions, cpu >= 0 ? ", pinned" : "");
+    printf("%-28s %10s %10s %10s %12s\n", "kernel", "median ns", "min ns", "spread", "Mops/s");
+
+    report("sphere::hit", time_kernel([&](size_t n) {
+        hit_record rec;
+        for (size_t i = 0; i < n; i++) {
+            bool hit = target.hit(rays[i % INPUT_COUNT], 0.001, infinity, rec);
+            keep(hit);
+        }
+    }, repetitions));
+
+    report("hittable_list::hit", time_kernel([&](size_t n) {
+        hit_record rec;
+        for (size_t i = 0; i < n; i++) {
+            bool hit = scene.world.hit(rays[i % INPUT_COUNT], 0.001, infinity, rec);
+            keep(hit);
+        }
+    }, repetitions));
+
+    report("pcg_random_float", time_kernel([&](size_t n) {
+        simd::uint1 s = 1;
+        for (size_t i = 0; i < n; i++) {
+            float x = pcg_random_float(s);
+            keep(x);
+        }
+    }, repetitions));
+
+    report("pcg_in_unit_sphere", time_kernel([&](size_t n) {
+        simd::uint1 s = 1;
+        for (size_t i = 0; i < n; i++) {
+            vec3 p = pcg_in_unit_sphere(s);
+            keep(p);
+        }
+    }, repetitions));
+
+    report("pcg_unit_vector", time_kernel([&](size_t n) {
+        simd::uint1 s = 1;
+        for (size_t i = 0; i < n; i++) {
+            vec3 p = pcg_unit_vector(s);
+            keep(p);
+        }
+    }, repetitions));
+
+    // The vector versions, per value, drawing INPUT_COUNT values per call
+    std::vector<simd::uint1> seeds(INPUT_COUNT);
+    std::vector<float> floats(INPUT_COUNT);
+    std::vector<vec3> unit_vectors(INPUT_COUNT);
+    std::vector<vec3> normals(INPUT_COUNT);
+    for (int i = 0; i < INPUT_COUNT; i++) {
+        seeds[i] = i;
+        normals[i] = hits[i % hits.size()].normal;
+    }
+
+    report("random_floats/val", time_kernel([&](size_t n) {
+        for (size_t i = 0; i < n; i += INPUT_COUNT) {
+            kernels().random_floats(seeds.data(), floats.data(), INPUT_COUNT);
+            keep(floats[0]);
+        }
+    }, repetitions));
+
+    report("random_unit_vectors/val", time_kernel([&](size_t n) {
+        for (size_t i = 0; i < n; i += INPUT_COUNT) {
+            kernels().random_unit_vectors(seeds.data(), unit_vectors.data(), INPUT_COUNT);
+            keep(unit_vectors[0]);
+        }
+    }, repetitions));
+
+    report("random_cosine_directions/val", time_kernel([&](size_t n) {
+        for (size_t i = 0; i < n; i += INPUT_COUNT) {
+            kernels().random_cosine_directions(seeds.data(), normals.data(), unit_vectors.data(), INPUT_COUNT);
+            keep(unit_vectors[0]);
+        }
+    }, repetitions));
+
+    // Through a material pointer, as the tracer calls them
+    report("lambertian::scatter", time_kernel([&](size_t n) {
+        ray scattered;
+        color attenuation;
+        for (size_t i = 0; i < n; i++) {
+            size_t k = i % hits.size();
+            simd::uint1 seed = i;
+            diffuse_material->scatter(rays[k], hits[k], attenuation, scattered, seed);
+            keep(scattered);
+        }
+    }, repetitions));
+
+    report("metal::scatter", time_kernel([&](size_t n) {
+        ray scattered;
+        color attenuation;
+        for (size_t i = 0; i < n; i++) {
+            size_t k = i % hits.size();
+            simd::uint1 seed = i;
+            metal_material->scatter(rays[k], hits[k], attenuation, scattered, seed);
+            keep(scattered);
+        }
+    }, repetitions));
+
+    report("camera::get_ray", time_kernel([&](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            ray r = cam.get_ray(us[i % INPUT_COUNT], vs[i % INPUT_COUNT]);
+            keep(r);
+        }
+    }, repetitions));
+
+    report("pack_color", time_kernel([&](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            uint p = pack_color(pixels[i % INPUT_COUNT], 4);
+            keep(p);
+        }
+    }, repetitions));
+
+    // Per pixel, packing INPUT_COUNT pixels per call
+    report("fast_color_pack/px", time_kernel([&](size_t n) {
+        for (size_t i = 0; i < n; i += INPUT_COUNT) {
+            fast_color_pack(pixels.data(), packed.data(), 4, INPUT_COUNT);
+            keep(packed[0]);
+        }
+    }, repetitions));
+
+    return 0;
+}
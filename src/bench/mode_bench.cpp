@@ -0,0 +1,230 @@
+#include "../headers/thread.h"
+#include "../headers/tracer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Renders the same fixed scenes through every render mode for a fixed number of
+// frames: the regular, PCG and wavefront integrators on the calling thread, and the
+// multi-threaded mode with 1, 2, 4, ... up to max_threads workers. Reports the median,
+// p95 and p99 frame time, rays per second and, for the threaded runs, parallel
+// efficiency against one worker. Scenes, seeds and frame counts are fixed, so two
+// builds can be compared run against run; the same numbers are written as JSON.
+//
+// usage: mode_bench [frames] [max_threads] [json_path]
+
+const auto BENCH_ASPECT = 16.0 / 9.0;
+const int BENCH_WIDTH = 1000;
+const int BENCH_HEIGHT = static_cast<int>(BENCH_WIDTH / BENCH_ASPECT);
+
+using integrator = std::function<void(Scene&, camera&, Parameters&, RenderTask)>;
+
+struct ModeResult {
+    std::string scene;
+    std::string mode;
+    int threads;
+    double median_ms;
+    double p95_ms;
+    double p99_ms;
+    double mrays_per_s;
+    double efficiency;
+};
+
+void usage(const char *name) {
+    fprintf(stderr, "usage: %s [frames] [max_threads] [json_path]\n", name);
+    exit(1);
+}
+
+// A positive whole-number argument, or usage() for anything else
+int parse_count(const char *value, const char *name) {
+    char *end = nullptr;
+    long count = strtol(value, &end, 10);
+    if (end == value || *end != '\0' || count < 1 || count > INT_MAX)
+        usage(name);
+    return static_cast<int>(count);
+}
+
+// Nearest-rank percentile of sorted frame times
+double percentile(const std::vector<double>& sorted, double p) {
+    size_t rank = static_cast<size_t>(std::ceil(p / 100 * sorted.size()));
+    return sorted[std::clamp<size_t>(rank, 1, sorted.size()) - 1];
+}
+
+// Every run starts from the same seeds, those of frame 0
+void reset_frames(Parameters& params) {
+    params.accumulated_frames = 0;
+    params.accumulated_samples = 0;
+}
+
+ModeResult summarize(const std::vector<double>& frame_ms, uint64_t rays) {
+    std::vector<double> sorted = frame_ms;
+    std::sort(sorted.begin(), sorted.end());
+
+    double total_ms = 0;
+    for (double ms : frame_ms)
+        total_ms += ms;
+
+    ModeResult result {};
+    result.median_ms = percentile(sorted, 50);
+    result.p95_ms = percentile(sorted, 95);
+    result.p99_ms = percentile(sorted, 99);
+    result.mrays_per_s = rays / (total_ms * 1e3);
+    result.threads = 1;
+    result.efficiency = 1;
+    return result;
+}
+
+// Renders and resolves whole frames on the calling thread
+ModeResult run_single(integrator render_frame, Scene& scene, camera& cam, Parameters& params, int frames) {
+    RenderTask frame { .start_x = 0, .start_y = 0, .end_x = BENCH_WIDTH, .end_y = (uint)BENCH_HEIGHT };
+    reset_frames(params);
+
+    std::vector<double> times;
+    uint64_t rays = 0;
+    for (int f = -1; f < frames; f++) {
+        params.ray_stats.reset();
+        auto start = NOW();
+        render_frame(scene, cam, params, frame);
+        resolve_tile(params, frame);
+        double ms = GET_TIME(NOW(), start) * 1e3;
+
+        params.accumulated_frames++;
+        params.accumulated_samples += params.samples_per_pixel;
+
+        // Frame -1 faults in the buffers and is not counted
+        if (f < 0)
+            continue;
+        times.push_back(ms);
+        rays += params.ray_stats.primary_rays + params.ray_stats.secondary_rays;
+    }
+    return summarize(times, rays);
+}
+
+ModeResult run_threaded(Scene& scene, camera& cam, Parameters& params, int threads, int frames) {
+    ThreadManager manager(BENCH_WIDTH, BENCH_HEIGHT, threads);
+    manager.threads_init([&](const RenderTask& task) {
+        pcg_render(scene, cam, params, task);
+        resolve_tile(params, task);
+    });
+    reset_frames(params);
+
+    std::vector<double> times;
+    uint64_t rays = 0;
+    for (int f = -1; f < frames; f++) {
+        params.ray_stats.reset();
+        auto start = NOW();
+        manager.push_tasks();
+        manager.wait_for_completion();
+        double ms = GET_TIME(NOW(), start) * 1e3;
+
+        params.accumulated_frames++;
+        params.accumulated_samples += params.samples_per_pixel;
+
+        if (f < 0)
+            continue;
+        times.push_back(ms);
+        rays += params.ray_stats.primary_rays + params.ray_stats.secondary_rays;
+    }
+
+    ModeResult result = summarize(times, rays);
+    result.threads = threads;
+    return result;
+}
+
+void write_json(const char *path, const std::vector<ModeResult>& results, int frames) {
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        fprintf(stderr, "failed to write %s\n", path);
+        return;
+    }
+
+    fprintf(file, "{\n  \"width\": %d,\n  \"height\": %d,\n  \"frames\": %d,\n  \"kernels\": \"%s\",\n  \"results\": [\n",
+        BENCH_WIDTH, BENCH_HEIGHT, frames, isa_name(kernels().target));
+    for (size_t i = 0; i < results.size(); i++) {
+        const ModeResult& r = results[i];
+        fprintf(file,
+            "    {\"scene\": \"%s\", \"mode\": \"%s\", \"threads\": %d, \"median_ms\": %.3f, "
+            "\"p95_ms\": %.3f, \"p99_ms\": %.3f, \"mrays_per_s\": %.3f, \"efficiency\": %.3f}%s\n",
+            r.scene.c_str(), r.mode.c_str(), r.threads, r.median_ms, r.p95_ms, r.p99_ms,
+            r.mrays_per_s, r.efficiency, i + 1 < results.size() ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+    fclose(file);
+}
+
+int main(int argc, char **argv) {
+    if (argc > 4)
+        usage(argv[0]);
+    int frames = argc > 1 ? parse_count(argv[1], argv[0]) : 20;
+    int max_threads = argc > 2 ? parse_count(argv[2], argv[0])
+                               : std::max(1u, std::thread::hardware_concurrency());
+    const char *json_path = argc > 3 ? argv[3] : "mode_bench.json";
+
+    std::vector<int> thread_counts;
+    for (int t = 1; t < max_threads; t *= 2)
+        thread_counts.push_back(t);
+    thread_counts.push_back(max_threads);
+
+    camera cam(BENCH_ASPECT);
+    Parameters params(BENCH_WIDTH, BENCH_HEIGHT);
+    params.pack_target = params.buffer;
+    params.pack_pitch = BENCH_WIDTH;
+
+    std::vector<ModeResult> results;
+    printf("%dx%d, %d frames per run\n", BENCH_WIDTH, BENCH_HEIGHT, frames);
+    printf("%-14s %-10s %8s %10s %10s %10s %10s %11s\n",
+        "scene", "mode", "threads", "median ms", "p95 ms", "p99 ms", "Mrays/s", "efficiency");
+
+    for (int sphere_count : { 0, 1000 }) {
+        Scene scene;
+        std::string scene_name;
+        if (sphere_count == 0) {
+            scene.init_scene1();
+            scene_name = "scene1";
+        } else {
+            scene.init_benchmark_scene(sphere_count);
+            scene_name = "random:" + std::to_string(sphere_count);
+        }
+
+        std::vector<std::pair<const char*, integrator>> single = {
+            { "regular", render },
+            { "pcg", pcg_render },
+            { "wavefront", wavefront_render },
+        };
+        for (auto& [name, render_frame] : single) {
+            ModeResult result = run_single(render_frame, scene, cam, params, frames);
+            result.scene = scene_name;
+            result.mode = name;
+            results.push_back(result);
+        }
+
+        double single_ms = 0;
+        for (int threads : thread_counts) {
+            ModeResult result = run_threaded(scene, cam, params, threads, frames);
+            if (threads == 1)
+                single_ms = result.median_ms;
+            result.scene = scene_name;
+            result.mode = "threaded";
+            result.efficiency = single_ms / result.median_ms / threads;
+            results.push_back(result);
+        }
+    }
+
+    for (const ModeResult& r : results) {
+        printf("%-14s %-10s %8d %10.2f %10.2f %10.2f %10.2f %10.0f%%\n",
+            r.scene.c_str(), r.mode.c_str(), r.threads, r.median_ms, r.p95_ms, r.p99_ms,
+            r.mrays_per_s, 100 * r.efficiency);
+    }
+
+    write_json(json_path, results, frames);
+    printf("wrote %s\n", json_path);
+    return 0;
+}
@@ -0,0 +1,114 @@
+#include "../headers/thread.h"
+#include "../headers/tracer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+// Renders and resolves the same frame of a random sphere scene through the work-stealing
+// ThreadManager with 1, 2, 4, ... up to max_threads workers and reports the median
+// frame time, the speedup and parallel efficiency against one worker, and how many
+// tiles had to be stolen per frame. First checks that the tiles cover every pixel
+// exactly once for frames down to a single pixel, cut for 1 to 64 cores.
+//
+// usage: thread_bench [max_threads] [frames] [sphere_count]
+
+const auto BENCH_ASPECT = 16.0 / 9.0;
+const int BENCH_WIDTH = 1000;
+const int BENCH_HEIGHT = static_cast<int>(BENCH_WIDTH / BENCH_ASPECT);
+
+void thread_render(const RenderTask &task, Scene &scene, camera &cam, Parameters &params) {
+    pcg_render(scene, cam, params, task);
+    resolve_tile(params, task);
+}
+
+struct ScalingResult {
+    double median_ms;
+    double steals_per_frame;
+};
+
+ScalingResult render_frames(Scene& scene, camera& cam, Parameters& params, int threads, int frames) {
+    ThreadManager manager(BENCH_WIDTH, BENCH_HEIGHT, threads);
+    manager.threads_init(thread_render, std::ref(scene), std::ref(cam), std::ref(params));
+
+    // One untimed frame to fault in the buffers and wake every worker
+    manager.push_tasks();
+    manager.wait_for_completion();
+
+    std::vector<double> times;
+    uint64_t steals = 0;
+    for (int f = 0; f < frames; f++) {
+        auto start = NOW();
+        manager.push_tasks();
+        manager.wait_for_completion();
+        times.push_back(GET_TIME(NOW(), start) * 1e3);
+        steals += manager.steals;
+    }
+
+    std::sort(times.begin(), times.end());
+    return ScalingResult { times[times.size() / 2], static_cast<double>(steals) / frames };
+}
+
+// Number of frame sizes and core counts whose tiles miss or overlap a pixel
+int check_tiling() {
+    ThreadManager manager(1, 1, 1);
+    int failures = 0;
+    for (uint threads = 1; threads <= 64; threads++) {
+        for (uint width : { 1u, 2u, 7u, 8u, 33u, 1000u }) {
+            for (uint height : { 1u, 3u, 8u, 562u }) {
+                std::vector<int> covered(width * height, 0);
+                for (const RenderTask &task : manager.generate_tasks(width, height, threads)) {
+                    for (uint j = task.start_y; j < task.end_y; j++)
+                        for (uint i = task.start_x; i < task.end_x; i++)
+                            covered[j * width + i]++;
+                }
+                if (std::any_of(covered.begin(), covered.end(), [](int n) { return n != 1; })) {
+                    fprintf(stderr, "tiling mismatch: %ux%u cut for %u cores\n", width, height, threads);
+                    failures++;
+                }
+            }
+        }
+    }
+    return failures;
+}
+
+int main(int argc, char **argv) {
+    int max_threads = argc > 1 ? atoi(argv[1]) : std::thread::hardware_concurrency();
+    int frames = argc > 2 ? atoi(argv[2]) : 20;
+    int sphere_count = argc > 3 ? atoi(argv[3]) : 1000;
+
+    if (check_tiling())
+        return 1;
+
+    Scene scene;
+    scene.init_benchmark_scene(sphere_count);
+
+    camera cam(BENCH_ASPECT);
+    Parameters params(BENCH_WIDTH, BENCH_HEIGHT);
+    params.pack_target = params.buffer;
+    params.pack_pitch = BENCH_WIDTH;
+
+    std::vector<int> thread_counts;
+    for (int t = 1; t < max_threads; t *= 2)
+        thread_counts.push_back(t);
+    thread_counts.push_back(max_threads);
+
+    printf("%d spheres, %dx%d, %d frames per run\n", sphere_count, BENCH_WIDTH, BENCH_HEIGHT, frames);
+    printf("%8s %12s %10s %12s %14s\n", "threads", "ms/frame", "speedup", "efficiency", "steals/frame");
+
+    double single_ms = 0;
+    for (int threads : thread_counts) {
+        ScalingResult result = render_frames(scene, cam, params, threads, frames);
+        if (threads == 1)
+            single_ms = result.median_ms;
+
+        double speedup = single_ms / result.median_ms;
+        printf("%8d %12.2f %9.2fx %11.0f%% %14.1f\n",
+            threads, result.median_ms, speedup, 100 * speedup / threads, result.steals_per_frame);
+    }
+
+    return 0;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "util.h"
+
+#include <algorithm>
+
+class aabb {
+public:
+    // An empty box; expanding it by anything yields that thing's bounds
+    aabb()
+        : minimum(simd::make_float3(infinity, infinity, infinity)),
+          maximum(simd::make_float3(-infinity, -infinity, -infinity)) {}
+    aabb(const point3& a, const point3& b) : minimum(a), maximum(b) {}
+
+    point3 min() const { return minimum; }
+    point3 max() const { return maximum; }
+
+    inline bool hit(const ray& r, simd::float1 t_min, simd::float1 t_max) const;
+    inline bool hit(const point3& origin, const vec3& inv_dir, simd::float1 t_min, simd::float1 t_max) const;
+
+    bool operator!=(const aabb& other) const {
+        for (int a = 0; a < 3; a++) {
+            if (minimum[a] != other.minimum[a] || maximum[a] != other.maximum[a])
+                return true;
+        }
+        return false;
+    }
+
+    point3 centroid() const { return 0.5f * (minimum + maximum); }
+    inline simd::float1 surface_area() const;
+    inline int longest_axis() const;
+
+    void expand(const aabb& box) {
+        minimum = simd::min(minimum, box.minimum);
+        maximum = simd::max(maximum, box.maximum);
+    }
+    void expand(const point3& p) {
+        minimum = simd::min(minimum, p);
+        maximum = simd::max(maximum, p);
+    }
+
+public:
+    point3 minimum;
+    point3 maximum;
+};
+
+inline aabb surrounding_box(const aabb& box0, const aabb& box1) {
+    return aabb(simd::min(box0.minimum, box1.minimum), simd::max(box0.maximum, box1.maximum));
+}
+
+inline bool aabb::hit(const ray& r, simd::float1 t_min, simd::float1 t_max) const {
+    return hit(r.origin(), 1.0f / r.direction(), t_min, t_max);
+}
+
+// Slab test against all three axes at once
+inline bool aabb::hit(const point3& origin, const vec3& inv_dir, simd::float1 t_min, simd::float1 t_max) const {
+    vec3 t0 = (minimum - origin) * inv_dir;
+    vec3 t1 = (maximum - origin) * inv_dir;
+
+    t_min = std::max(t_min, simd::reduce_max(simd::min(t0, t1)));
+    t_max = std::min(t_max, simd::reduce_min(simd::max(t0, t1)));
+    return t_min <= t_max;
+}
+
+inline simd::float1 aabb::surface_area() const {
+    vec3 d = maximum - minimum;
+    if (d.x < 0 || d.y < 0 || d.z < 0)
+        return 0;
+    return 2 * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+inline int aabb::longest_axis() const {
+    vec3 d = maximum - minimum;
+    if (d.x > d.y && d.x > d.z)
+        return 0;
+    return d.y > d.z ? 1 : 2;
+}
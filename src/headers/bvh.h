@@ -0,0 +1,266 @@
+#pragma once
+
+#include "hittable.h"
+#include "aabb.h"
+
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+// Number of candidate split planes the SAH builder evaluates per axis
+const int BVH_SAH_BINS = 16;
+
+// A refitted node whose surface area grew past this multiple of its area at build
+// time is considered degraded and its subtree gets rebuilt
+const simd::float1 BVH_REFIT_THRESHOLD = 2.0;
+
+// Traversal counters for comparing tree layouts, compiled out unless BVH_STATS is defined
+struct bvh_counters {
+    uint64_t rays = 0;
+    uint64_t node_visits = 0;
+};
+
+#ifdef BVH_STATS
+inline thread_local bvh_counters bvh_stats;
+#define BVH_COUNT(_field) (bvh_stats._field++)
+#else
+#define BVH_COUNT(_field)
+#endif
+
+class bvh_node;
+using bvh_leaf_map = std::unordered_map<const hittable*, bvh_node*>;
+
+struct bvh_primitive {
+    shared_ptr<hittable> object;
+    aabb box;
+    point3 centroid;
+};
+
+class bvh_node : public hittable {
+public:
+    bvh_node() {}
+    bvh_node(const std::vector<shared_ptr<hittable>>& objects);
+    bvh_node(std::vector<bvh_primitive>& primitives, size_t start, size_t end) {
+        build(primitives, start, end);
+    }
+
+    virtual bool hit(
+        const ray& r, simd::float1 t_min, simd::float1 t_max, hit_record& rec) const override;
+    virtual bool bounding_box(aabb& output_box) const override;
+
+    // Sets parent pointers below this node and records which leaf holds each object
+    void link(bvh_node *parent_node, bvh_leaf_map& leaves);
+    void collect(std::vector<shared_ptr<hittable>>& objects) const;
+
+    // Recomputes bounds from this node up to the root after one of its objects moved.
+    // Returns the highest node that degraded past BVH_REFIT_THRESHOLD, or nullptr.
+    bvh_node *refit();
+
+private:
+    // The traversal below the root, with the ray's inverse direction computed once
+    bool hit(const ray& r, const vec3& inv_dir, simd::float1 t_min, simd::float1 t_max, hit_record& rec) const;
+    void build(std::vector<bvh_primitive>& primitives, size_t start, size_t end);
+    size_t sah_split(std::vector<bvh_primitive>& primitives, size_t start, size_t end, const aabb& centroid_bounds);
+
+public:
+    shared_ptr<hittable> left;
+    shared_ptr<hittable> right;
+    aabb box;
+    int axis = 0;
+
+    bvh_node *parent = nullptr;
+    bool leaf = false;
+    simd::float1 build_area = 0;
+};
+
+bvh_node::bvh_node(const std::vector<shared_ptr<hittable>>& objects) {
+    std::vector<bvh_primitive> primitives;
+    primitives.reserve(objects.size());
+
+    for (const auto& object : objects) {
+        bvh_primitive prim;
+        prim.object = object;
+        object->bounding_box(prim.box);
+        prim.centroid = prim.box.centroid();
+        primitives.push_back(prim);
+    }
+
+    if (!primitives.empty())
+        build(primitives, 0, primitives.size());
+}
+
+void bvh_node::build(std::vector<bvh_primitive>& primitives, size_t start, size_t end) {
+    aabb centroid_bounds;
+    for (size_t i = start; i < end; i++) {
+        box.expand(primitives[i].box);
+        centroid_bounds.expand(primitives[i].centroid);
+    }
+    axis = centroid_bounds.longest_axis();
+    build_area = box.surface_area();
+
+    size_t count = end - start;
+    leaf = count <= 2;
+    if (count == 1) {
+        left = right = primitives[start].object;
+        return;
+    }
+    if (count == 2) {
+        if (primitives[start + 1].centroid[axis] < primitives[start].centroid[axis])
+            std::swap(primitives[start], primitives[start + 1]);
+        left = primitives[start].object;
+        right = primitives[start + 1].object;
+        return;
+    }
+
+    size_t mid = sah_split(primitives, start, end, centroid_bounds);
+    left = make_shared<bvh_node>(primitives, start, mid);
+    right = make_shared<bvh_node>(primitives, mid, end);
+}
+
+// Binned surface area heuristic: bucket centroids along each axis, sweep the
+// buckets from both ends and split where count * area summed over both sides is lowest.
+size_t bvh_node::sah_split(std::vector<bvh_primitive>& primitives, size_t start, size_t end, const aabb& centroid_bounds) {
+    struct bin {
+        aabb box;
+        size_t count = 0;
+    };
+
+    simd::float1 best_cost = infinity;
+    int best_axis = -1;
+    int best_bin = 0;
+
+    for (int a = 0; a < 3; a++) {
+        simd::float1 lo = centroid_bounds.minimum[a];
+        simd::float1 extent = centroid_bounds.maximum[a] - lo;
+        if (extent <= 0)
+            continue;
+
+        bin bins[BVH_SAH_BINS];
+        for (size_t i = start; i < end; i++) {
+            int b = std::min(BVH_SAH_BINS - 1, static_cast<int>(BVH_SAH_BINS * (primitives[i].centroid[a] - lo) / extent));
+            bins[b].box.expand(primitives[i].box);
+            bins[b].count++;
+        }
+
+        // right_area[i]/right_count[i] describe bins (i, BVH_SAH_BINS)
+        simd::float1 right_area[BVH_SAH_BINS];
+        size_t right_count[BVH_SAH_BINS];
+        aabb acc;
+        size_t n = 0;
+        for (int i = BVH_SAH_BINS - 1; i > 0; i--) {
+            acc.expand(bins[i].box);
+            n += bins[i].count;
+            right_area[i - 1] = acc.surface_area();
+            right_count[i - 1] = n;
+        }
+
+        acc = aabb();
+        n = 0;
+        for (int i = 0; i < BVH_SAH_BINS - 1; i++) {
+            acc.expand(bins[i].box);
+            n += bins[i].count;
+            if (n == 0 || right_count[i] == 0)
+                continue;
+
+            simd::float1 cost = n * acc.surface_area() + right_count[i] * right_area[i];
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_axis = a;
+                best_bin = i;
+            }
+        }
+    }
+
+    // Every centroid coincides, any split is as good as another
+    if (best_axis < 0)
+        return start + (end - start) / 2;
+
+    axis = best_axis;
+    simd::float1 lo = centroid_bounds.minimum[axis];
+    simd::float1 extent = centroid_bounds.maximum[axis] - lo;
+    auto it = std::partition(primitives.begin() + start, primitives.begin() + end,
+        [&](const bvh_primitive& prim) {
+            int b = std::min(BVH_SAH_BINS - 1, static_cast<int>(BVH_SAH_BINS * (prim.centroid[axis] - lo) / extent));
+            return b <= best_bin;
+        });
+    return it - primitives.begin();
+}
+
+bool bvh_node::hit(const ray& r, simd::float1 t_min, simd::float1 t_max, hit_record& rec) const {
+    return hit(r, 1.0f / r.direction(), t_min, t_max, rec);
+}
+
+bool bvh_node::hit(const ray& r, const vec3& inv_dir, simd::float1 t_min, simd::float1 t_max, hit_record& rec) const {
+    BVH_COUNT(node_visits);
+    if (!box.hit(r.origin(), inv_dir, t_min, t_max))
+        return false;
+
+    // Visit the child nearer the ray origin first so the other one can be culled against rec.t
+    const hittable *first = left.get();
+    const hittable *second = right.get();
+    if (r.direction()[axis] < 0)
+        std::swap(first, second);
+
+    if (!leaf) {
+        bool hit_first = static_cast<const bvh_node*>(first)->hit(r, inv_dir, t_min, t_max, rec);
+        bool hit_second = static_cast<const bvh_node*>(second)->hit(r, inv_dir, t_min, hit_first ? rec.t : t_max, rec);
+        return hit_first || hit_second;
+    }
+
+    bool hit_first = first->hit(r, t_min, t_max, rec);
+    if (first == second)
+        return hit_first;
+    bool hit_second = second->hit(r, t_min, hit_first ? rec.t : t_max, rec);
+
+    return hit_first || hit_second;
+}
+
+bool bvh_node::bounding_box(aabb& output_box) const {
+    output_box = box;
+    return true;
+}
+
+void bvh_node::link(bvh_node *parent_node, bvh_leaf_map& leaves) {
+    parent = parent_node;
+    if (leaf) {
+        leaves[left.get()] = this;
+        leaves[right.get()] = this;
+        return;
+    }
+    std::static_pointer_cast<bvh_node>(left)->link(this, leaves);
+    std::static_pointer_cast<bvh_node>(right)->link(this, leaves);
+}
+
+void bvh_node::collect(std::vector<shared_ptr<hittable>>& objects) const {
+    if (leaf) {
+        objects.push_back(left);
+        if (right != left)
+            objects.push_back(right);
+        return;
+    }
+    std::static_pointer_cast<bvh_node>(left)->collect(objects);
+    std::static_pointer_cast<bvh_node>(right)->collect(objects);
+}
+
+bvh_node *bvh_node::refit() {
+    bvh_node *degraded = nullptr;
+
+    for (bvh_node *node = this; node; node = node->parent) {
+        aabb left_box, right_box;
+        node->left->bounding_box(left_box);
+        node->right->bounding_box(right_box);
+        aabb refitted = surrounding_box(left_box, right_box);
+
+        bool changed = refitted != node->box;
+        node->box = refitted;
+
+        // Area relative to build time is the node's share of the SAH cost
+        if (node->box.surface_area() > BVH_REFIT_THRESHOLD * node->build_area)
+            degraded = node;
+
+        // Nothing above an unchanged node can change either
+        if (!changed && node != this)
+            break;
+    }
+    return degraded;
+}
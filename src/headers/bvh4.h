@@ -0,0 +1,482 @@
+#pragma once
+
+#include "bvh.h"
+#include "lanes.h"
+#include "sphere.h"
+#include "sphere_soa.h"
+
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#if defined(__SSE4_2__)
+using bvh4_lanes = lanes_sse4;
+#elif defined(__ARM_NEON)
+using bvh4_lanes = lanes_neon;
+#endif
+
+// Four children per node with their bounds stored as parallel arrays, so one
+// SIMD slab test covers every child box of a node.
+struct bvh4_node {
+    float min_x[4] = {}, min_y[4] = {}, min_z[4] = {};
+    float max_x[4] = {}, max_y[4] = {}, max_z[4] = {};
+
+    // >= 0 is the index of an inner node, < 0 is ~(first_primitive << 1 | (count - 1))
+    int32_t child[4] = {};
+    int num_children = 0;
+
+    // Slots [0, split) came from the collapsed node's left child, [split, num_children)
+    // from its right; axis[0] split the two halves, axis[1]/axis[2] split within them
+    int split = 0;
+    int axis[3] = { 0, 0, 0 };
+
+    int parent = -1;
+    int parent_slot = 0;
+    int depth = 1;
+    const bvh_node *source = nullptr;
+
+    inline void set_bounds(int slot, const aabb& box);
+    inline aabb bounds(int slot) const;
+    inline void near_to_far(const vec3& dir, int order[4]) const;
+    inline int intersect(const point3& origin, const vec3& inv_dir, simd::float1 t_min, simd::float1 t_max, float t_near[4]) const;
+};
+
+class bvh4 : public hittable {
+public:
+    bvh4() {}
+    bvh4(const bvh_node& root) { collapse(root, -1, 0); }
+
+    virtual bool hit(
+        const ray& r, simd::float1 t_min, simd::float1 t_max, hit_record& rec) const override;
+    virtual bool bounding_box(aabb& output_box) const override;
+    virtual uint32_t hit_packet(ray_packet& packet, simd::float1 t_min, hit_record recs[]) const override;
+
+    // Recomputes the bounds of the slot holding `object` and of every node above it.
+    // Returns false if the object isn't in the tree.
+    bool refit(const hittable *object);
+
+    // Index of the node collapsed from `source`, or -1 if it was pulled up into its parent
+    int find(const bvh_node *source) const;
+
+    // Replaces the subtree at `index` with a fresh collapse of `source`, which must cover
+    // the same objects. Returns false when the caller should collapse the whole tree instead.
+    bool recollapse(int index, const bvh_node& source);
+
+private:
+    int collapse(const bvh_node& node, int parent, int parent_slot);
+    int32_t add_leaf(const bvh_node& leaf, int node, int slot);
+    void add_primitive(const hittable *object, int node, int slot);
+
+    // Refits the slot above `index` to the node's children, and so on up to the root
+    void refit_upward(int index);
+
+    // Closest primitive of a leaf hit in [t_min, t_max), lowering t_max to it, or -1
+    int hit_leaf(const KernelTable& table, int32_t leaf, const ray& r, simd::float1 t_min, simd::float1& t_max) const;
+    // Fills `rec` for a ray that hit primitive `closest` at `t`
+    void hit_record_for(int closest, const ray& r, simd::float1 t, simd::float1 t_min, hit_record& rec) const;
+
+    // Traversal stack entries needed: a node pops one entry and pushes up to four, so
+    // each level of the tree leaves at most three siblings waiting on the stack
+    int stack_size() const { return 3 * max_depth + 1; }
+
+public:
+    std::vector<bvh4_node> nodes;
+    std::vector<const hittable*> primitives;
+    aabb box;
+
+    // The primitives again, in the same order, packed for the dispatched sphere kernel
+    // so a leaf is tested without a virtual call per sphere. Only used when every
+    // primitive is a sphere.
+    sphere_soa spheres;
+    bool all_spheres = true;
+
+private:
+    std::unordered_map<const hittable*, std::pair<int, int>> leaf_slots;
+    std::unordered_map<const bvh_node*, int> collapsed_from;
+    size_t stale_nodes = 0;
+    int max_depth = 0;
+};
+
+inline void bvh4_node::set_bounds(int slot, const aabb& b) {
+    min_x[slot] = b.minimum.x; min_y[slot] = b.minimum.y; min_z[slot] = b.minimum.z;
+    max_x[slot] = b.maximum.x; max_y[slot] = b.maximum.y; max_z[slot] = b.maximum.z;
+}
+
+inline aabb bvh4_node::bounds(int slot) const {
+    return aabb(
+        simd::make_float3(min_x[slot], min_y[slot], min_z[slot]),
+        simd::make_float3(max_x[slot], max_y[slot], max_z[slot]));
+}
+
+// Slot order from the signs of the direction along the split axes; fills num_children entries
+inline void bvh4_node::near_to_far(const vec3& dir, int order[4]) const {
+    int n = 0;
+    int halves[2][2] = { { 0, split }, { split, num_children } };
+    int first_half = dir[axis[0]] < 0 ? 1 : 0;
+    for (int h = first_half, k = 0; k < 2; h ^= 1, k++) {
+        int begin = halves[h][0], end = halves[h][1];
+        bool reverse = end - begin == 2 && dir[axis[1 + h]] < 0;
+        for (int s = 0; s < end - begin; s++)
+            order[n++] = reverse ? end - 1 - s : begin + s;
+    }
+}
+
+#if defined(__SSE4_2__) || defined(__ARM_NEON)
+// Returns a bit per child box the ray enters within [t_min, t_max], with its entry distance
+inline int bvh4_node::intersect(const point3& origin, const vec3& inv_dir, simd::float1 t_min, simd::float1 t_max, float t_near[4]) const {
+    using L = bvh4_lanes;
+
+    L::f32 ox = L::set1(origin.x), oy = L::set1(origin.y), oz = L::set1(origin.z);
+    L::f32 ix = L::set1(inv_dir.x), iy = L::set1(inv_dir.y), iz = L::set1(inv_dir.z);
+
+    L::f32 tx0 = L::mul(L::sub(L::load(min_x), ox), ix), tx1 = L::mul(L::sub(L::load(max_x), ox), ix);
+    L::f32 ty0 = L::mul(L::sub(L::load(min_y), oy), iy), ty1 = L::mul(L::sub(L::load(max_y), oy), iy);
+    L::f32 tz0 = L::mul(L::sub(L::load(min_z), oz), iz), tz1 = L::mul(L::sub(L::load(max_z), oz), iz);
+
+    L::f32 enter = L::max(L::max(L::min(tx0, tx1), L::min(ty0, ty1)), L::max(L::min(tz0, tz1), L::set1(t_min)));
+    L::f32 t_exit = L::min(L::min(L::max(tx0, tx1), L::max(ty0, ty1)), L::min(L::max(tz0, tz1), L::set1(t_max)));
+
+    L::store(t_near, enter);
+    return L::bits(L::le(enter, t_exit)) & ((1 << num_children) - 1);
+}
+#else
+inline int bvh4_node::intersect(const point3& origin, const vec3& inv_dir, simd::float1 t_min, simd::float1 t_max, float t_near[4]) const {
+    int mask = 0;
+    for (int i = 0; i < num_children; i++) {
+        aabb b(simd::make_float3(min_x[i], min_y[i], min_z[i]), simd::make_float3(max_x[i], max_y[i], max_z[i]));
+        vec3 t0 = (b.minimum - origin) * inv_dir;
+        vec3 t1 = (b.maximum - origin) * inv_dir;
+        t_near[i] = std::max(t_min, simd::reduce_max(simd::min(t0, t1)));
+        if (t_near[i] <= std::min(t_max, simd::reduce_min(simd::max(t0, t1))))
+            mask |= 1 << i;
+    }
+    return mask;
+}
+#endif
+
+// Pulls the grandchildren of `node` up into one four-wide node. A child that is
+// already a leaf keeps a single slot, so nodes next to leaves can have 2 or 3 slots.
+int bvh4::collapse(const bvh_node& node, int parent, int parent_slot) {
+    int index = nodes.size();
+    nodes.emplace_back();
+    nodes[index].parent = parent;
+    nodes[index].parent_slot = parent_slot;
+    nodes[index].depth = parent < 0 ? 1 : nodes[parent].depth + 1;
+    max_depth = std::max(max_depth, nodes[index].depth);
+    nodes[index].axis[0] = node.axis;
+    nodes[index].source = &node;
+    collapsed_from[&node] = index;
+    if (parent < 0)
+        box = node.box;
+
+    const bvh_node *slots[4];
+    int n = 0;
+    if (node.leaf) {
+        slots[n++] = &node;
+        nodes[index].split = 1;
+    } else {
+        const bvh_node *halves[2] = {
+            static_cast<const bvh_node*>(node.left.get()),
+            static_cast<const bvh_node*>(node.right.get())
+        };
+        for (int h = 0; h < 2; h++) {
+            nodes[index].axis[1 + h] = halves[h]->axis;
+            if (halves[h]->leaf) {
+                slots[n++] = halves[h];
+            } else {
+                slots[n++] = static_cast<const bvh_node*>(halves[h]->left.get());
+                slots[n++] = static_cast<const bvh_node*>(halves[h]->right.get());
+            }
+            if (h == 0)
+                nodes[index].split = n;
+        }
+    }
+
+    nodes[index].num_children = n;
+    for (int s = 0; s < n; s++) {
+        nodes[index].set_bounds(s, slots[s]->box);
+        // collapse() grows `nodes`, so only hold on to the index across the call
+        int32_t child = slots[s]->leaf ? add_leaf(*slots[s], index, s) : collapse(*slots[s], index, s);
+        nodes[index].child[s] = child;
+    }
+    return index;
+}
+
+int32_t bvh4::add_leaf(const bvh_node& leaf, int node, int slot) {
+    int first = primitives.size();
+    add_primitive(leaf.left.get(), node, slot);
+    if (leaf.right != leaf.left)
+        add_primitive(leaf.right.get(), node, slot);
+    int count = primitives.size() - first;
+    return ~((first << 1) | (count - 1));
+}
+
+void bvh4::add_primitive(const hittable *object, int node, int slot) {
+    primitives.push_back(object);
+    leaf_slots[object] = { node, slot };
+    if (auto s = dynamic_cast<const sphere*>(object)) {
+        spheres.add(*s);
+    } else {
+        spheres.add(simd::make_float3(0, 0, 0), 0, 0);
+        all_spheres = false;
+    }
+}
+
+int bvh4::hit_leaf(const KernelTable& table, int32_t leaf, const ray& r, simd::float1 t_min, simd::float1& t_max) const {
+    int code = ~leaf;
+    int first = code >> 1;
+    int count = (code & 1) + 1;
+    if (all_spheres) {
+        int i = table.sphere_closest_hit(spheres.span(first, count), r, t_min, t_max);
+        return i < 0 ? -1 : first + i;
+    }
+
+    int closest = -1;
+    hit_record rec;
+    for (int i = first; i < first + count; i++) {
+        if (primitives[i]->hit(r, t_min, t_max, rec)) {
+            closest = i;
+            t_max = rec.t;
+        }
+    }
+    return closest;
+}
+
+void bvh4::hit_record_for(int closest, const ray& r, simd::float1 t, simd::float1 t_min, hit_record& rec) const {
+    if (!all_spheres) {
+        primitives[closest]->hit(r, t_min, t, rec);
+        return;
+    }
+
+    // Material and position come from the sphere itself, its material can be swapped
+    // without touching the tree
+    const sphere *s = static_cast<const sphere*>(primitives[closest]);
+    rec.t = t;
+    rec.p = r.at(t);
+    rec.mat_id = s->mat_id;
+    rec.set_face_normal(r, (rec.p - s->center) / s->radius);
+}
+
+bool bvh4::hit(const ray& r, simd::float1 t_min, simd::float1 t_max, hit_record& rec) const {
+    if (nodes.empty())
+        return false;
+
+    struct entry {
+        int32_t child;
+        float t_near;
+    };
+    // Degenerate inputs can build trees too deep for the fixed stack
+    entry local[128];
+    std::vector<entry> spill;
+    entry *stack = local;
+    if (stack_size() > 128) {
+        spill.resize(stack_size());
+        stack = spill.data();
+    }
+    int top = 0;
+    stack[top++] = { 0, t_min };
+
+    point3 origin = r.origin();
+    vec3 dir = r.direction();
+    vec3 inv_dir = 1.0f / dir;
+    const KernelTable& table = kernels();
+    int closest = -1;
+
+    while (top > 0) {
+        entry e = stack[--top];
+        if (e.t_near > t_max)
+            continue;
+
+        if (e.child < 0) {
+            int i = hit_leaf(table, e.child, r, t_min, t_max);
+            if (i >= 0)
+                closest = i;
+            continue;
+        }
+
+        const bvh4_node& node = nodes[e.child];
+        BVH_COUNT(node_visits);
+
+        float t_near[4];
+        int mask = node.intersect(origin, inv_dir, t_min, t_max, t_near);
+        if (!mask)
+            continue;
+
+        int order[4];
+        node.near_to_far(dir, order);
+
+        // Push far to near so the nearest child is popped first
+        for (int k = node.num_children - 1; k >= 0; k--) {
+            int s = order[k];
+            if (mask & (1 << s))
+                stack[top++] = { node.child[s], t_near[s] };
+        }
+    }
+
+    if (closest < 0)
+        return false;
+    hit_record_for(closest, r, t_max, t_min, rec);
+    return true;
+}
+
+// Masked packet traversal: the packet walks the tree as one, each node's boxes are
+// fetched once for all of its rays, children outside the packet frustum are dropped
+// without testing any ray, and a child is only descended into with the rays that hit it.
+uint32_t bvh4::hit_packet(ray_packet& packet, simd::float1 t_min, hit_record recs[]) const {
+    if (nodes.empty() || !packet.active)
+        return 0;
+
+    struct entry {
+        int32_t child;
+        uint32_t rays;
+    };
+    // Degenerate inputs can build trees too deep for the fixed stack
+    entry local[128];
+    std::vector<entry> spill;
+    entry *stack = local;
+    if (stack_size() > 128) {
+        spill.resize(stack_size());
+        stack = spill.data();
+    }
+    int top = 0;
+    stack[top++] = { 0, packet.active };
+
+    // Children are ordered by the first ray, the others are close enough to agree
+    vec3 dir = packet.rays[__builtin_ctz(packet.active)].direction();
+    const KernelTable& table = kernels();
+    int closest[PACKET_SIZE];
+    uint32_t hits = 0;
+
+    while (top > 0) {
+        entry e = stack[--top];
+
+        if (e.child < 0) {
+            for (uint32_t rays = e.rays; rays; rays &= rays - 1) {
+                int j = __builtin_ctz(rays);
+                int i = hit_leaf(table, e.child, packet.rays[j], t_min, packet.t_max[j]);
+                if (i >= 0) {
+                    closest[j] = i;
+                    hits |= 1u << j;
+                }
+            }
+            continue;
+        }
+
+        const bvh4_node& node = nodes[e.child];
+        BVH_COUNT(node_visits);
+
+        int live = (1 << node.num_children) - 1;
+        for (int s = 0; s < node.num_children; s++) {
+            if (packet.outside_frustum(node.bounds(s)))
+                live &= ~(1 << s);
+        }
+        if (!live)
+            continue;
+
+        uint32_t child_rays[4] = { 0, 0, 0, 0 };
+        float t_near[4];
+        for (uint32_t rays = e.rays; rays; rays &= rays - 1) {
+            int k = __builtin_ctz(rays);
+            int mask = node.intersect(packet.rays[k].origin(), packet.inv_dir[k], t_min, packet.t_max[k], t_near) & live;
+            for (; mask; mask &= mask - 1)
+                child_rays[__builtin_ctz(mask)] |= 1u << k;
+        }
+
+        int order[4];
+        node.near_to_far(dir, order);
+        for (int k = node.num_children - 1; k >= 0; k--) {
+            int s = order[k];
+            if (child_rays[s])
+                stack[top++] = { node.child[s], child_rays[s] };
+        }
+    }
+
+    for (uint32_t rays = hits; rays; rays &= rays - 1) {
+        int j = __builtin_ctz(rays);
+        hit_record_for(closest[j], packet.rays[j], packet.t_max[j], t_min, recs[j]);
+    }
+    return hits;
+}
+
+bool bvh4::bounding_box(aabb& output_box) const {
+    output_box = box;
+    return !nodes.empty();
+}
+
+bool bvh4::refit(const hittable *object) {
+    auto found = leaf_slots.find(object);
+    if (found == leaf_slots.end())
+        return false;
+
+    auto [index, slot] = found->second;
+    int code = ~nodes[index].child[slot];
+    int first = code >> 1;
+    int count = (code & 1) + 1;
+
+    aabb slot_box;
+    for (int i = first; i < first + count; i++) {
+        aabb prim_box;
+        primitives[i]->bounding_box(prim_box);
+        slot_box.expand(prim_box);
+        if (all_spheres)
+            spheres.set(i, *static_cast<const sphere*>(primitives[i]));
+    }
+    nodes[index].set_bounds(slot, slot_box);
+    refit_upward(index);
+    return true;
+}
+
+void bvh4::refit_upward(int index) {
+    while (index >= 0) {
+        const bvh4_node& node = nodes[index];
+        aabb node_box;
+        for (int s = 0; s < node.num_children; s++) {
+            node_box.expand(aabb(
+                simd::make_float3(node.min_x[s], node.min_y[s], node.min_z[s]),
+                simd::make_float3(node.max_x[s], node.max_y[s], node.max_z[s])));
+        }
+
+        if (node.parent < 0) {
+            box = node_box;
+            break;
+        }
+        nodes[node.parent].set_bounds(node.parent_slot, node_box);
+        index = node.parent;
+    }
+}
+
+int bvh4::find(const bvh_node *source) const {
+    auto found = collapsed_from.find(source);
+    return found == collapsed_from.end() ? -1 : found->second;
+}
+
+bool bvh4::recollapse(int index, const bvh_node& source) {
+    if (index <= 0)
+        return false;
+
+    // The old subtree stays in `nodes` unreachable; forget where it came from since
+    // its source nodes are about to be freed and their addresses reused
+    std::vector<int> pending = { index };
+    while (!pending.empty()) {
+        int i = pending.back();
+        pending.pop_back();
+        collapsed_from.erase(nodes[i].source);
+        stale_nodes++;
+        for (int s = 0; s < nodes[i].num_children; s++) {
+            if (nodes[i].child[s] >= 0)
+                pending.push_back(nodes[i].child[s]);
+        }
+    }
+    if (stale_nodes > nodes.size() / 2)
+        return false;
+
+    int parent = nodes[index].parent;
+    int slot = nodes[index].parent_slot;
+    int fresh = collapse(source, parent, slot);
+    nodes[parent].child[slot] = fresh;
+
+    // The objects moved since the slot was last fitted, so its box and every box above it
+    // have to follow the new subtree
+    refit_upward(fresh);
+    return true;
+}
@@ -1,13 +1,15 @@
 #pragma once
 
 #include "util.h"
-#include <arm_neon.h>
+#include "packet.h"
+#include <algorithm>
 
 class camera {
 public:
     camera(simd::float1 aspect_ratio);
   
     ray get_ray(float u, float v) const;
+    void get_packet(const float u[], const float v[], uint32_t active, ray_packet& packet) const;
 
 public:
     point3 origin;
@@ -30,3 +32,30 @@ camera::camera(simd::float1 aspect_ratio) {
 ray camera::get_ray(float u, float v) const {
     return ray(origin, lower_left_corner + u*horizontal + v*vertical - origin);
 }
+
+// Fills the packet's active lanes with get_ray(u[k], v[k]) and bounds them with a frustum
+void camera::get_packet(const float u[], const float v[], uint32_t active, ray_packet& packet) const {
+    float u_min = infinity, u_max = -infinity;
+    float v_min = infinity, v_max = -infinity;
+
+    packet.active = active;
+    for (int k = 0; k < PACKET_SIZE; k++) {
+        if (!(active & (1u << k)))
+            continue;
+        packet.rays[k] = get_ray(u[k], v[k]);
+        packet.inv_dir[k] = 1.0f / packet.rays[k].direction();
+        packet.t_max[k] = infinity;
+
+        u_min = std::min(u_min, u[k]); u_max = std::max(u_max, u[k]);
+        v_min = std::min(v_min, v[k]); v_max = std::max(v_max, v[k]);
+    }
+
+    // get_ray is affine in u and v, so the corner rays bound every ray in between
+    vec3 corners[4] = {
+        get_ray(u_min, v_min).direction(),
+        get_ray(u_max, v_min).direction(),
+        get_ray(u_max, v_max).direction(),
+        get_ray(u_min, v_max).direction(),
+    };
+    packet.set_frustum(origin, corners);
+}
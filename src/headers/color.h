@@ -1,8 +1,8 @@
 #pragma once
 
-#include "render.h"
 #include "util.h"
 #include "vec3.h"
+#include "dispatch.h"
 
 color set_color(color &pixel_color, simd::int1 samples_per_pixel) {
     auto pr = pixel_color.x;
@@ -36,44 +36,8 @@ static inline uint pack_color(color &pixel_color, int samples_per_pixel) {
     return (0xFF << 24) | (clamped.z << 16) | (clamped.y << 8) | clamped.x;
 }
 
-void write_color(Renderer &renderer, color pixel_color, int samples_per_pixel, int x, int y) {
-    color pixel = set_color(pixel_color, samples_per_pixel);
-    renderer.set_pixel(x, y, pixel.x, pixel.y, pixel.z);
-}
-
-void accumulate(Renderer& renderer, color old_buffer[], color new_buffer[], int samples_per_pixel) {
-    float weight = 1.0 / (renderer.frame_count() + 1.0);
-    for (int j = renderer.get_texture_height()-1; j >= 0; j--) {
-        for (int i = 0; i < renderer.get_texture_width(); i++) {
-            int index = (j * renderer.get_texture_width()) + i;
-            new_buffer[index] = set_color(new_buffer[index], samples_per_pixel);
-            new_buffer[index] = old_buffer[index] * (1 - weight) + new_buffer[index] * weight;
-            renderer.set_pixel(i, j, new_buffer[index].x, new_buffer[index].y, new_buffer[index].z);
-        }
-    }  
-}
-
-inline void fast_color_pack(simd::float3 *pixel_colors, uint *output, int samples_per_pixel, int len) {
-
-    float32x4_t lower = vdupq_n_f32(0.0f);
-    float32x4_t upper = vdupq_n_f32(0.999f);
-    float32x4_t scale = vdupq_n_f32(1.0f / samples_per_pixel);
-    uint32x4_t red, green, blue, alpha;
-
-
-    for (int i = 0; i < len; i += 4) {
-        float32x4x4_t color = vld4q_f32((const float *)&pixel_colors[i]);
-        for (int n = 0; n < 4; n++) {
-            color.val[n] = vsqrtq_f32(vmulq_f32(color.val[n], scale));
-        }
-
-        red   = vcvtq_u32_f32(vmulq_n_f32(vminq_f32(vmaxq_f32(color.val[0], lower), upper), 256));
-        green = vcvtq_u32_f32(vmulq_n_f32(vminq_f32(vmaxq_f32(color.val[1], lower), upper), 256));
-        blue  = vcvtq_u32_f32(vmulq_n_f32(vminq_f32(vmaxq_f32(color.val[2], lower), upper), 256));
-        alpha = vdupq_n_u32(256);//vcvtq_u32_f32(vmulq_n_f32(vminq_f32(vmaxq_f32(color.val[3], lower), upper), 256));
-
-        uint32x4_t packed = vorrq_u32(vshlq_n_u32(alpha, 24), vorrq_u32(vshlq_n_u32(blue, 16), vorrq_u32(vshlq_n_u32(green, 8), red)));
-
-        vst1q_u32(&output[i], packed);
-    }
+// Packs len HDR pixels with the color_pack kernel picked for this CPU. `stream`
+// writes the output with non-temporal stores where the CPU has them.
+inline void fast_color_pack(simd::float3 *pixel_colors, uint *output, int samples_per_pixel, int len, bool stream = false) {
+    kernels().color_pack(pixel_colors, output, samples_per_pixel, len, stream);
 }
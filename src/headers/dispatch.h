@@ -0,0 +1,124 @@
+#pragma once
+
+#include "isa.h"
+#include "lanes.h"
+#include "wavefront.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// The arrays of a sphere_soa, as the sphere kernels see them
+struct sphere_span {
+    const float *center_x;
+    const float *center_y;
+    const float *center_z;
+    const float *radius;
+    size_t count;
+};
+
+// One copy of kernels.h per instruction set the compiler can target here, all
+// without FMA contraction so every copy gives the scalar copy's results
+ISA_EXACT_FP_PUSH()
+#define KERNEL_ISA_SCALAR 0
+#define KERNEL_ISA_SSE4 1
+#define KERNEL_ISA_AVX2 2
+#define KERNEL_ISA_AVX512 3
+#define KERNEL_ISA_NEON 4
+
+#define KERNEL_NAMESPACE kernels_scalar
+#define KERNEL_LANES lanes_scalar
+#define KERNEL_ISA KERNEL_ISA_SCALAR
+#include "kernels.h"
+#undef KERNEL_NAMESPACE
+#undef KERNEL_LANES
+#undef KERNEL_ISA
+
+#if ISA_X86
+ISA_TARGET_PUSH(ISA_TARGET_SSE4)
+#define KERNEL_NAMESPACE kernels_sse4
+#define KERNEL_LANES lanes_sse4
+#define KERNEL_ISA KERNEL_ISA_SSE4
+#include "kernels.h"
+#undef KERNEL_NAMESPACE
+#undef KERNEL_LANES
+#undef KERNEL_ISA
+ISA_TARGET_POP()
+
+ISA_TARGET_PUSH(ISA_TARGET_AVX2)
+#define KERNEL_NAMESPACE kernels_avx2
+#define KERNEL_LANES lanes_avx2
+#define KERNEL_ISA KERNEL_ISA_AVX2
+#include "kernels.h"
+#undef KERNEL_NAMESPACE
+#undef KERNEL_LANES
+#undef KERNEL_ISA
+ISA_TARGET_POP()
+
+ISA_TARGET_PUSH(ISA_TARGET_AVX512)
+#define KERNEL_NAMESPACE kernels_avx512
+#define KERNEL_LANES lanes_avx512
+#define KERNEL_ISA KERNEL_ISA_AVX512
+#include "kernels.h"
+#undef KERNEL_NAMESPACE
+#undef KERNEL_LANES
+#undef KERNEL_ISA
+ISA_TARGET_POP()
+#endif
+
+#if defined(__ARM_NEON)
+#define KERNEL_NAMESPACE kernels_neon
+#define KERNEL_LANES lanes_neon
+#define KERNEL_ISA KERNEL_ISA_NEON
+#include "kernels.h"
+#undef KERNEL_NAMESPACE
+#undef KERNEL_LANES
+#undef KERNEL_ISA
+#endif
+ISA_EXACT_FP_POP()
+
+// The variant of every dispatched kernel for one instruction set. The material
+// scatters the regular and PCG modes call one hit at a time are not in here: they
+// stay virtual and are built for the baseline, and only the wavefront shaders that
+// scatter whole queues are dispatched.
+struct KernelTable {
+    isa target;
+    void (*color_pack)(const color *pixels, uint *output, int samples_per_pixel, int len, bool stream);
+    int (*sphere_closest_hit)(const sphere_span& s, const ray& r, simd::float1 t_min, simd::float1& t_max);
+    void (*shade_lambertian)(const WavefrontQueues &queues, const std::vector<material*> &materials, std::vector<path_state> &next);
+    void (*shade_metal)(const WavefrontQueues &queues, const std::vector<material*> &materials, std::vector<path_state> &next);
+    void (*random_floats)(simd::uint1 *seeds, float *out, int count);
+    void (*random_unit_vectors)(simd::uint1 *seeds, vec3 *out, int count);
+    void (*random_cosine_directions)(simd::uint1 *seeds, const vec3 *normals, vec3 *out, int count);
+};
+
+#define KERNEL_TABLE(_isa, _namespace) KernelTable { \
+    .target = _isa, \
+    .color_pack = _namespace::color_pack, \
+    .sphere_closest_hit = _namespace::sphere_closest_hit, \
+    .shade_lambertian = _namespace::shade_lambertian, \
+    .shade_metal = _namespace::shade_metal, \
+    .random_floats = _namespace::random_floats, \
+    .random_unit_vectors = _namespace::random_unit_vectors, \
+    .random_cosine_directions = _namespace::random_cosine_directions, \
+}
+
+inline KernelTable kernel_table(isa target) {
+    switch (target) {
+#if ISA_X86
+        case isa::sse4: return KERNEL_TABLE(isa::sse4, kernels_sse4);
+        case isa::avx2: return KERNEL_TABLE(isa::avx2, kernels_avx2);
+        case isa::avx512: return KERNEL_TABLE(isa::avx512, kernels_avx512);
+#endif
+#if defined(__ARM_NEON)
+        case isa::neon: return KERNEL_TABLE(isa::neon, kernels_neon);
+#endif
+        default: return KERNEL_TABLE(isa::scalar, kernels_scalar);
+    }
+}
+
+// Bound on first use to the variant select_isa picks for this CPU
+inline const KernelTable& kernels() {
+    static const KernelTable table = kernel_table(select_isa());
+    return table;
+}
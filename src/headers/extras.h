@@ -1,29 +1,14 @@
 #pragma once
 
 #include <SDL.h>
-#include <arm_neon.h>
 
 #include "util.h"
 #include "sphere.h"
+#include "parameters.h"
 
-struct Parameters {
-    Parameters(int width, int height) 
-        : tex_width(width), tex_height(height) {}
-    ~Parameters() {
-        delete[] buffer; 
-        delete[] color_buffer;
-    }
-
-    int tex_width, tex_height;
-    uint *buffer = new uint[tex_width*tex_height]();
-    color *color_buffer = new color[tex_width*tex_height]();
-
-    bool switched = false;
-    int render_type = 0;
-    int samples_per_pixel = 1;
-};
-
-inline void handle_inputs(const Uint8* keystates, shared_ptr<sphere> sphere, Parameters& parameters, simd::double1 dt) {
+// Returns true if the controlled sphere moved this frame
+inline bool handle_inputs(const Uint8* keystates, shared_ptr<sphere> sphere, Parameters& parameters, simd::double1 dt) {
+    point3 old_center = sphere->center;
     if (keystates[SDL_SCANCODE_W]) { sphere->center[2] -= 1 * dt; }
     if (keystates[SDL_SCANCODE_A]) { sphere->center[0] -= 1 * dt; }
     if (keystates[SDL_SCANCODE_S]) { sphere->center[2] += 1 * dt; }
@@ -34,4 +19,6 @@ inline void handle_inputs(const Uint8* keystates, shared_ptr<sphere> sphere, Par
     if (keystates[SDL_SCANCODE_R]) { parameters.render_type = 2; parameters.switched = true; }
 
     if (keystates[SDL_SCANCODE_ESCAPE]) { SDL_Quit(); exit(0); }
+
+    return sphere->center[0] != old_center[0] || sphere->center[2] != old_center[2];
 }
@@ -1,13 +1,15 @@
 #pragma once
 
 #include "util.h"
+#include "aabb.h"
+#include "packet.h"
 
 class material;
 
 struct hit_record {
     point3 p;
     vec3 normal;
-    shared_ptr<material> mat;
+    uint32_t mat_id;
     float t;
     bool front_face;
 
@@ -17,9 +19,26 @@ struct hit_record {
 class hittable {
 public:
     virtual bool hit(const ray& r, simd::float1 t_min, simd::float1 t_max, hit_record& rec) const = 0;
+    virtual bool bounding_box(aabb& output_box) const = 0;
+
+    // Traces every active ray of the packet, lowering packet.t_max to each hit.
+    // Returns a bit per ray that hit something; the default traces them one by one.
+    virtual uint32_t hit_packet(ray_packet& packet, simd::float1 t_min, hit_record recs[]) const;
+
     virtual ~hittable() {}
 };
 
+uint32_t hittable::hit_packet(ray_packet& packet, simd::float1 t_min, hit_record recs[]) const {
+    uint32_t hits = 0;
+    for (int k = 0; k < PACKET_SIZE; k++) {
+        if ((packet.active & (1u << k)) && hit(packet.rays[k], t_min, packet.t_max[k], recs[k])) {
+            hits |= 1u << k;
+            packet.t_max[k] = recs[k].t;
+        }
+    }
+    return hits;
+}
+
 inline void hit_record::set_face_normal(const ray &r, const vec3 &outward_normal) {
     front_face = simd::dot(r.direction(), outward_normal) < 0;
     normal = front_face ? outward_normal : -outward_normal;
@@ -3,6 +3,8 @@
 #include "hittable.h"
 #include "material.h"
 #include "sphere.h"
+#include "bvh.h"
+#include "bvh4.h"
 
 #include <vector>
 
@@ -16,28 +18,133 @@ public:
     hittable_list() {}
     hittable_list(shared_ptr<hittable> object) { add(object); }
 
-    void clear() { objects.clear(); }
-    void add(shared_ptr<hittable> object) { objects.emplace_back(object); }
+    void clear() { objects.clear(); clear_bvh(); }
+    void add(shared_ptr<hittable> object) { objects.emplace_back(object); clear_bvh(); }
+
+    // Must be called again whenever an object is added or removed
+    void build_bvh();
+    void clear_bvh() { bvh.reset(); wide_bvh.reset(); bvh_leaves.clear(); }
+
+    // Updates the BVH after `object` moved: bounds are refitted from its leaf up to the
+    // root and only a subtree that degraded past BVH_REFIT_THRESHOLD is rebuilt
+    void refit(const hittable *object);
 
     virtual bool hit(
         const ray& r, simd::float1 t_min, simd::float1 t_max, hit_record& rec) const override;
+    virtual bool bounding_box(aabb& output_box) const override;
+    virtual uint32_t hit_packet(ray_packet& packet, simd::float1 t_min, hit_record recs[]) const override;
 
   
 public:
     std::vector<shared_ptr<hittable>> objects;
+    shared_ptr<bvh_node> bvh;
+    bvh_leaf_map bvh_leaves;
+
+    // Traverse a four-wide copy of the binary tree instead of the tree itself
+    bool use_wide_bvh = true;
+    shared_ptr<bvh4> wide_bvh;
+
+private:
+    // Swaps a non-root subtree for a fresh SAH build over the same objects
+    bvh_node *rebuild_subtree(bvh_node *node);
 };
 
 struct Scene {
+    // `materials` owns them, `material_table` is what hit_record::mat_id indexes
     std::vector<shared_ptr<material>> materials;
+    std::vector<material*> material_table;
     hittable_list world;
     shared_ptr<hittable> controlled;
 
     void toggle_controlled(int current_index);
+    uint32_t add_material(shared_ptr<material> mat);
+
+    // Gives `target` a new material, in the slot it already has unless another
+    // sphere shares that slot, so swapping materials does not grow the table
+    void replace_material(sphere &target, shared_ptr<material> mat);
+
+    // A deep copy with a BVH of its own, which can be rendered while this scene
+    // keeps being edited
+    shared_ptr<Scene> snapshot() const;
+
+    // Brings an earlier snapshot that nothing renders any more up to date: changed
+    // materials are cloned again, moved spheres copied and the copy's BVH refitted over
+    // them. Returns false, leaving the copy to be thrown away, when spheres were added
+    // or removed or so many moved that a fresh snapshot is cheaper.
+    bool update_snapshot(Scene &copy) const;
+    material *get_material(uint32_t id) const { return material_table[id]; }
 
     void init_scene1();
+    void init_benchmark_scene(int sphere_count, simd::uint1 seed = 1);
 };
 
+void hittable_list::build_bvh() {
+    clear_bvh();
+    if (objects.empty())
+        return;
+
+    bvh = make_shared<bvh_node>(objects);
+    bvh->link(nullptr, bvh_leaves);
+    if (use_wide_bvh)
+        wide_bvh = make_shared<bvh4>(*bvh);
+}
+
+void hittable_list::refit(const hittable *object) {
+    auto leaf = bvh_leaves.find(object);
+    if (!bvh || leaf == bvh_leaves.end()) {
+        build_bvh();
+        return;
+    }
+
+    bvh_node *degraded = leaf->second->refit();
+    if (!degraded) {
+        if (wide_bvh)
+            wide_bvh->refit(object);
+        return;
+    }
+    if (degraded == bvh.get()) {
+        build_bvh();
+        return;
+    }
+
+    // The wide tree mirrors the binary one: the degraded node either became a wide
+    // node of its own or was pulled up into the wide node made from its parent
+    bvh_node *parent = degraded->parent;
+    int wide_node = wide_bvh ? wide_bvh->find(degraded) : -1;
+    bool own_node = wide_node >= 0;
+    if (wide_bvh && !own_node)
+        wide_node = wide_bvh->find(parent);
+
+    bvh_node *rebuilt = rebuild_subtree(degraded);
+
+    if (wide_bvh && !wide_bvh->recollapse(wide_node, own_node ? *rebuilt : *parent))
+        wide_bvh = make_shared<bvh4>(*bvh);
+}
+
+bvh_node *hittable_list::rebuild_subtree(bvh_node *node) {
+
+    std::vector<shared_ptr<hittable>> subtree_objects;
+    node->collect(subtree_objects);
+
+    // Same objects, so the new subtree has the same bounds and the ancestors stay valid
+    bvh_node *parent = node->parent;
+    auto rebuilt = make_shared<bvh_node>(subtree_objects);
+    rebuilt->link(parent, bvh_leaves);
+
+    if (parent->left.get() == node)
+        parent->left = rebuilt;
+    else
+        parent->right = rebuilt;
+    return rebuilt.get();
+}
+
 bool hittable_list::hit(const ray& r, simd::float1 t_min, simd::float1 t_max, hit_record& rec) const {
+    BVH_COUNT(rays);
+    if (wide_bvh)
+        return wide_bvh->hit(r, t_min, t_max, rec);
+    if (bvh)
+        return bvh->hit(r, t_min, t_max, rec);
+
     hit_record temp_rec;
     bool hit_anything = false;
     auto closest_so_far = t_max;
@@ -52,18 +159,146 @@ bool hittable_list::hit(const ray& r, simd::float1 t_min, simd::float1 t_max, hi
     return hit_anything;
 }
 
+uint32_t hittable_list::hit_packet(ray_packet& packet, simd::float1 t_min, hit_record recs[]) const {
+    if (wide_bvh)
+        return wide_bvh->hit_packet(packet, t_min, recs);
+    return hittable::hit_packet(packet, t_min, recs);
+}
+
+bool hittable_list::bounding_box(aabb& output_box) const {
+    if (objects.empty())
+        return false;
+
+    output_box = aabb();
+    for (const auto& object : objects) {
+        aabb box;
+        if (!object->bounding_box(box))
+            return false;
+        output_box.expand(box);
+    }
+    return true;
+}
+
+uint32_t Scene::add_material(shared_ptr<material> mat) {
+    material_table.push_back(mat.get());
+    materials.push_back(std::move(mat));
+    return material_table.size() - 1;
+}
+
+void Scene::replace_material(sphere &target, shared_ptr<material> mat) {
+    for (const auto &object : world.objects) {
+        const sphere &other = *std::static_pointer_cast<sphere>(object);
+        if (&other != &target && other.mat_id == target.mat_id) {
+            target.mat_id = add_material(std::move(mat));
+            return;
+        }
+    }
+    material_table[target.mat_id] = mat.get();
+    materials[target.mat_id] = std::move(mat);
+}
+
+shared_ptr<Scene> Scene::snapshot() const {
+    auto copy = make_shared<Scene>();
+    for (const auto &mat : materials)
+        copy->add_material(mat->clone());
+
+    copy->world.use_wide_bvh = world.use_wide_bvh;
+    for (const auto &object : world.objects) {
+        auto s = make_shared<sphere>(*std::static_pointer_cast<sphere>(object));
+        copy->world.objects.push_back(s);
+        if (object == controlled)
+            copy->controlled = s;
+    }
+    copy->world.build_bvh();
+    return copy;
+}
+
+bool Scene::update_snapshot(Scene &copy) const {
+    if (copy.world.objects.size() != world.objects.size() || copy.world.use_wide_bvh != world.use_wide_bvh)
+        return false;
+
+    auto same = [](const vec3 &a, const vec3 &b) { return a.x == b.x && a.y == b.y && a.z == b.z; };
+    if (copy.materials.size() != materials.size()) {
+        copy.materials.clear();
+        copy.material_table.clear();
+        for (const auto &mat : materials)
+            copy.add_material(mat->clone());
+    }
+    for (size_t i = 0; i < materials.size(); i++) {
+        if (copy.materials[i]->type != materials[i]->type ||
+            !same(copy.materials[i]->get_color(), materials[i]->get_color())) {
+            copy.materials[i] = materials[i]->clone();
+            copy.material_table[i] = copy.materials[i].get();
+        }
+    }
+
+    std::vector<const hittable*> moved;
+    for (size_t i = 0; i < world.objects.size(); i++) {
+        const sphere &from = *std::static_pointer_cast<sphere>(world.objects[i]);
+        sphere &to = *std::static_pointer_cast<sphere>(copy.world.objects[i]);
+        if (!same(to.center, from.center) || to.radius != from.radius) {
+            to.center = from.center;
+            to.radius = from.radius;
+            moved.push_back(&to);
+        }
+        to.mat_id = from.mat_id;
+        if (world.objects[i] == controlled)
+            copy.controlled = copy.world.objects[i];
+    }
+
+    // Past this many moves one SAH build beats refitting each of them
+    if (moved.size() > world.objects.size() / 8)
+        return false;
+    for (const hittable *object : moved)
+        copy.world.refit(object);
+    return true;
+}
+
 void Scene::toggle_controlled(int current_index) {
     controlled = world.objects[current_index];
 }
 
 void Scene::init_scene1() {
-    materials.emplace_back(make_shared<lambertian>(simd::make_float3(0.8, 0.8, 0.0)));
-    materials.emplace_back(make_shared<lambertian>(simd::make_float3(0.1, 0.2, 0.5)));
+    uint32_t ground = add_material(make_shared<lambertian>(simd::make_float3(0.8, 0.8, 0.0)));
+    uint32_t center = add_material(make_shared<lambertian>(simd::make_float3(0.1, 0.2, 0.5)));
 
-    auto sphere_ground = make_shared<sphere>(simd::make_float3( 0.0, -100.5, -1.0), 100.0, materials[0]);
-    auto sphere1 = make_shared<sphere>(simd::make_float3( 0.0,    0.0, -1.2),   0.5, materials[1]);
+    auto sphere_ground = make_shared<sphere>(simd::make_float3( 0.0, -100.5, -1.0), 100.0, ground);
+    auto sphere1 = make_shared<sphere>(simd::make_float3( 0.0,    0.0, -1.2),   0.5, center);
     world.add(sphere_ground);
     world.add(sphere1);
 
     controlled = sphere1;
+    world.build_bvh();
+}
+
+// Ground plus `sphere_count` small random spheres spread out in front of the camera
+void Scene::init_benchmark_scene(int sphere_count, simd::uint1 seed) {
+    const int material_count = 16;
+    uint32_t first_material = material_table.size();
+    for (int i = 0; i < material_count; i++) {
+        color albedo = 0.1 + 0.8 * pcg_random3(seed);
+        if (i % 4 == 0)
+            add_material(make_shared<metal>(albedo));
+        else
+            add_material(make_shared<lambertian>(albedo));
+    }
+
+    world.add(make_shared<sphere>(simd::make_float3(0.0, -1000.5, -1.0), 1000.0, first_material));
+
+    // Keep the density roughly constant by growing the field with the sphere count
+    simd::float1 extent = std::max(4.0, std::sqrt(sphere_count) * 0.15);
+    simd::float1 radius = 0.05;
+    for (int i = 0; i < sphere_count; i++) {
+        vec3 r = pcg_random3(seed);
+        point3 center = simd::make_float3(
+            (2 * r.x - 1) * extent,
+            -0.5 + radius + r.y * 2.0,
+            -1.0 - r.z * 2 * extent
+        );
+        world.add(make_shared<sphere>(center, radius, first_material + i % material_count));
+    }
+
+    // The ground is the only object when there are no spheres to pick from
+    controlled = world.objects[std::min<size_t>(1, world.objects.size() - 1)];
+    world.build_bvh();
 }
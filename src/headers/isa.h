@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+
+// Instruction sets the hot kernels are compiled for, from slowest to fastest
+enum class isa { scalar, sse4, avx2, avx512, neon };
+
+inline const char *isa_name(isa target) {
+    switch (target) {
+        case isa::sse4: return "sse4";
+        case isa::avx2: return "avx2";
+        case isa::avx512: return "avx512";
+        case isa::neon: return "neon";
+        default: return "scalar";
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#define ISA_X86 1
+#else
+#define ISA_X86 0
+#endif
+
+// Everything defined between ISA_TARGET_PUSH and ISA_TARGET_POP is compiled for
+// the given target even if the rest of the program is not, so several copies of a
+// kernel can live in one binary and be picked at runtime.
+#define ISA_STRINGIFY(_x) #_x
+#if defined(__clang__)
+#define ISA_TARGET_PUSH(_target) \
+    _Pragma(ISA_STRINGIFY(clang attribute push(__attribute__((target(_target))), apply_to = function)))
+#define ISA_TARGET_POP() _Pragma("clang attribute pop")
+#else
+#define ISA_TARGET_PUSH(_target) _Pragma("GCC push_options") _Pragma(ISA_STRINGIFY(GCC target(_target)))
+#define ISA_TARGET_POP() _Pragma("GCC pop_options")
+#endif
+
+// Between ISA_EXACT_FP_PUSH and ISA_EXACT_FP_POP the compiler may not fuse a * b + c
+// into one FMA, so copies compiled for targets with and without FMA round alike
+#if defined(__clang__)
+#define ISA_EXACT_FP_PUSH() _Pragma("float_control(push)") _Pragma("clang fp contract(off)")
+#define ISA_EXACT_FP_POP() _Pragma("float_control(pop)")
+#else
+#define ISA_EXACT_FP_PUSH() _Pragma("GCC push_options") _Pragma("GCC optimize(\"fp-contract=off\")")
+#define ISA_EXACT_FP_POP() _Pragma("GCC pop_options")
+#endif
+
+#define ISA_TARGET_SSE4 "sse4.2"
+#define ISA_TARGET_AVX2 "avx2,fma"
+#define ISA_TARGET_AVX512 "avx512f,avx2,fma"
+
+inline bool isa_supported(isa target) {
+#if ISA_X86
+    __builtin_cpu_init();
+#endif
+    switch (target) {
+        case isa::scalar: return true;
+#if ISA_X86
+        case isa::sse4: return __builtin_cpu_supports("sse4.2");
+        case isa::avx2: return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+        case isa::avx512: return __builtin_cpu_supports("avx512f") && isa_supported(isa::avx2);
+#endif
+#if defined(__ARM_NEON)
+        case isa::neon: return true;
+#endif
+        default: return false;
+    }
+}
+
+inline isa best_isa() {
+    for (isa target : { isa::neon, isa::avx512, isa::avx2, isa::sse4 }) {
+        if (isa_supported(target))
+            return target;
+    }
+    return isa::scalar;
+}
+
+// The best instruction set this CPU runs, unless RAYSDL_ISA names another one
+// (scalar, sse4, avx2, avx512 or neon) that it also runs. Logs the choice.
+inline isa select_isa() {
+    isa best = best_isa();
+    isa chosen = best;
+
+    if (const char *forced = std::getenv("RAYSDL_ISA")) {
+        bool found = false;
+        for (isa target : { isa::scalar, isa::sse4, isa::avx2, isa::avx512, isa::neon }) {
+            if (std::strcmp(forced, isa_name(target)) == 0) {
+                found = true;
+                if (isa_supported(target))
+                    chosen = target;
+                else
+                    fprintf(stderr, "RAYSDL_ISA=%s is not supported on this CPU\n", forced);
+            }
+        }
+        if (!found)
+            fprintf(stderr, "RAYSDL_ISA=%s is not a known instruction set\n", forced);
+    }
+
+    fprintf(stderr, "kernels: %s (best supported: %s)\n", isa_name(chosen), isa_name(best));
+    return chosen;
+}
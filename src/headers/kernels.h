@@ -0,0 +1,437 @@
+// Bodies of the hot kernels. dispatch.h includes this file once per instruction
+// set, each time inside a different target region and with KERNEL_NAMESPACE,
+// KERNEL_LANES and KERNEL_ISA set, so there is deliberately no include guard.
+
+namespace KERNEL_NAMESPACE {
+
+// Index of the closest sphere hit in [begin, count) with t in [t_min, t_max), or -1.
+// On a hit t_max is lowered to that sphere's t.
+template<typename L>
+int closest_hit(const sphere_span& s, const ray& r, simd::float1 t_min, simd::float1& t_max, size_t begin) {
+    using f32 = typename L::f32;
+    using mask = typename L::mask;
+
+    // Too few spheres to fill one register, such as a BVH leaf: skip the lane setup
+    if constexpr (L::width > 1) {
+        if (s.count - begin < L::width)
+            return closest_hit<lanes_scalar>(s, r, t_min, t_max, begin);
+    }
+
+    point3 o = r.origin();
+    vec3 d = r.direction();
+    const f32 ox = L::set1(o.x), oy = L::set1(o.y), oz = L::set1(o.z);
+    const f32 dx = L::set1(d.x), dy = L::set1(d.y), dz = L::set1(d.z);
+    const f32 a = L::set1(simd::length_squared(d));
+    const f32 zero = L::set1(0);
+    const f32 lo = L::set1(t_min);
+
+    f32 closest_t = L::set1(t_max);
+    f32 closest_i = L::set1(-1);
+    f32 index = L::add(L::iota(), L::set1(begin));
+    const f32 step = L::set1(L::width);
+
+    size_t n = s.count;
+    size_t i = begin;
+    for (; i + L::width <= n; i += L::width) {
+        f32 ocx = L::sub(ox, L::load(&s.center_x[i]));
+        f32 ocy = L::sub(oy, L::load(&s.center_y[i]));
+        f32 ocz = L::sub(oz, L::load(&s.center_z[i]));
+        f32 rad = L::load(&s.radius[i]);
+
+        f32 half_b = L::add(L::add(L::mul(ocx, dx), L::mul(ocy, dy)), L::mul(ocz, dz));
+        f32 c = L::sub(L::add(L::add(L::mul(ocx, ocx), L::mul(ocy, ocy)), L::mul(ocz, ocz)), L::mul(rad, rad));
+        f32 discriminant = L::sub(L::mul(half_b, half_b), L::mul(a, c));
+
+        mask real = L::le(zero, discriminant);
+        f32 sqrtd = L::sqrt(L::max(discriminant, zero));
+        f32 near_root = L::div(L::sub(L::sub(zero, half_b), sqrtd), a);
+        f32 far_root = L::div(L::sub(sqrtd, half_b), a);
+
+        // Same root selection as sphere::hit, for every lane at once
+        mask near_ok = L::both(real, L::both(L::le(lo, near_root), L::lt(near_root, closest_t)));
+        mask far_ok = L::both(real, L::both(L::le(lo, far_root), L::lt(far_root, closest_t)));
+        mask ok = L::either(near_ok, far_ok);
+
+        closest_t = L::select(ok, L::select(near_ok, near_root, far_root), closest_t);
+        closest_i = L::select(ok, index, closest_i);
+        index = L::add(index, step);
+    }
+
+    float lane_t[L::width], lane_i[L::width];
+    L::store(lane_t, closest_t);
+    L::store(lane_i, closest_i);
+
+    int best = -1;
+    for (int l = 0; l < L::width; l++) {
+        if (lane_i[l] >= 0 && lane_t[l] <= t_max) {
+            best = static_cast<int>(lane_i[l]);
+            t_max = lane_t[l];
+        }
+    }
+
+    if constexpr (L::width > 1) {
+        if (i < n) {
+            int tail = closest_hit<lanes_scalar>(s, r, t_min, t_max, i);
+            if (tail >= 0)
+                best = tail;
+        }
+    }
+    return best;
+}
+
+inline int sphere_closest_hit(const sphere_span& s, const ray& r, simd::float1 t_min, simd::float1& t_max) {
+    return closest_hit<KERNEL_LANES>(s, r, t_min, t_max, 0);
+}
+
+// L::width independent PCG streams advanced together: lane k holds one seed and
+// draws exactly the numbers pcg_random_float would draw from it
+template<typename L>
+struct pcg_lanes {
+    using f32 = typename L::f32;
+    using u32 = typename L::u32;
+    using mask = typename L::mask;
+
+    u32 state;
+
+    explicit pcg_lanes(const simd::uint1 *seeds) : state(L::load_u32(seeds)) {}
+    void store(simd::uint1 *seeds) const { L::store_u32(seeds, state); }
+
+    f32 next_float() {
+        state = L::add_u32(L::mul_u32(state, L::set1_u32(747796405)), L::set1_u32(2891336453u));
+        u32 shift = L::add_u32(L::srl(state, 28), L::set1_u32(4));
+        u32 result = L::mul_u32(L::xor_u32(L::srlv(state, shift), state), L::set1_u32(277803737));
+        result = L::xor_u32(L::srl(result, 22), result);
+
+        // The top 24 bits convert to float exactly, even through a signed conversion
+        return L::mul(L::to_f32(L::srl(result, 8)), L::set1(0x1p-24f));
+    }
+
+    // sincos_2pi for every lane, the same polynomials in the same order
+    static void sincos_2pi(f32 v, f32 &sin, f32 &cos) {
+        const f32 one = L::set1(1), two = L::set1(2);
+        f32 x = L::mul(L::set1(static_cast<float>(pi)), L::sub(v, L::set1(0.5f)));
+        f32 x2 = L::mul(x, x);
+
+        f32 half_sin = L::set1(-1 / 39916800.0f);
+        for (float c : { 1 / 362880.0f, -1 / 5040.0f, 1 / 120.0f, -1 / 6.0f, 1.0f })
+            half_sin = L::add(L::set1(c), L::mul(x2, half_sin));
+        half_sin = L::mul(x, half_sin);
+
+        f32 half_cos = L::set1(1 / 479001600.0f);
+        for (float c : { -1 / 3628800.0f, 1 / 40320.0f, -1 / 720.0f, 1 / 24.0f, -1 / 2.0f, 1.0f })
+            half_cos = L::add(L::set1(c), L::mul(x2, half_cos));
+
+        sin = L::sub(L::set1(0), L::mul(L::mul(two, half_sin), half_cos));
+        cos = L::sub(L::mul(L::mul(two, half_sin), half_sin), one);
+    }
+
+    // pcg_unit_vector for every lane: two draws mapped onto the sphere, so every
+    // lane costs the same and none waits on another's rejection loop
+    void next_unit_vector(f32 &x, f32 &y, f32 &z) {
+        f32 u = next_float();
+        f32 v = next_float();
+        const f32 one = L::set1(1);
+        z = L::sub(one, L::mul(L::set1(2), u));
+        f32 r = L::sqrt(L::max(L::set1(0), L::sub(one, L::mul(z, z))));
+        f32 sin, cos;
+        sincos_2pi(v, sin, cos);
+        x = L::mul(r, cos);
+        y = L::mul(r, sin);
+    }
+
+    // lambertian::scatter_direction for every lane, around the lane's unit normal
+    void next_cosine_direction(f32 nx, f32 ny, f32 nz, f32 &x, f32 &y, f32 &z) {
+        f32 u = next_float();
+        f32 v = next_float();
+        const f32 one = L::set1(1);
+        f32 r = L::sqrt(u), height = L::sqrt(L::sub(one, u));
+        f32 sin, cos;
+        sincos_2pi(v, sin, cos);
+        f32 disk_x = L::mul(r, cos), disk_y = L::mul(r, sin);
+
+        f32 sign = L::select(L::lt(nz, L::set1(0)), L::set1(-1), one);
+        f32 a = L::div(L::set1(-1), L::add(sign, nz));
+        f32 b = L::mul(L::mul(nx, ny), a);
+        f32 tx = L::add(one, L::mul(L::mul(sign, L::mul(nx, nx)), a));
+        f32 ty = L::mul(sign, b);
+        f32 tz = L::sub(L::set1(0), L::mul(sign, nx));
+        f32 by = L::add(sign, L::mul(L::mul(ny, ny), a));
+        f32 bz = L::sub(L::set1(0), ny);
+
+        x = L::add(L::add(L::mul(tx, disk_x), L::mul(b, disk_y)), L::mul(nx, height));
+        y = L::add(L::add(L::mul(ty, disk_x), L::mul(by, disk_y)), L::mul(ny, height));
+        z = L::add(L::add(L::mul(tz, disk_x), L::mul(bz, disk_y)), L::mul(nz, height));
+    }
+};
+
+// Writes the lanes of three coordinate registers out as vectors
+template<typename L>
+inline void store_vectors(vec3 *out, typename L::f32 x, typename L::f32 y, typename L::f32 z) {
+    float lane_x[L::width], lane_y[L::width], lane_z[L::width];
+    L::store(lane_x, x);
+    L::store(lane_y, y);
+    L::store(lane_z, z);
+    for (int l = 0; l < L::width; l++)
+        out[l] = simd::make_float3(lane_x[l], lane_y[l], lane_z[l]);
+}
+
+// Advances each of the count seeds once, writing the float pcg_random_float would
+inline void random_floats(simd::uint1 *seeds, float *out, int count) {
+    using L = KERNEL_LANES;
+    int i = 0;
+    for (; i + L::width <= count; i += L::width) {
+        pcg_lanes<L> rng(seeds + i);
+        L::store(out + i, rng.next_float());
+        rng.store(seeds + i);
+    }
+    for (; i < count; i++)
+        out[i] = pcg_random_float(seeds[i]);
+}
+
+// Draws pcg_unit_vector from each of the count seeds
+inline void random_unit_vectors(simd::uint1 *seeds, vec3 *out, int count) {
+    using L = KERNEL_LANES;
+    int i = 0;
+    for (; i + L::width <= count; i += L::width) {
+        pcg_lanes<L> rng(seeds + i);
+        typename L::f32 x, y, z;
+        rng.next_unit_vector(x, y, z);
+        rng.store(seeds + i);
+        store_vectors<L>(out + i, x, y, z);
+    }
+    for (; i < count; i++)
+        out[i] = pcg_unit_vector(seeds[i]);
+}
+
+// Draws from each of the count seeds the cosine-weighted bounce around normals[i]
+// that lambertian::scatter_direction gives
+inline void random_cosine_directions(simd::uint1 *seeds, const vec3 *normals, vec3 *out, int count) {
+    using L = KERNEL_LANES;
+    int i = 0;
+    for (; i + L::width <= count; i += L::width) {
+        float lane_x[L::width], lane_y[L::width], lane_z[L::width];
+        for (int l = 0; l < L::width; l++) {
+            lane_x[l] = normals[i + l].x;
+            lane_y[l] = normals[i + l].y;
+            lane_z[l] = normals[i + l].z;
+        }
+
+        pcg_lanes<L> rng(seeds + i);
+        typename L::f32 x, y, z;
+        rng.next_cosine_direction(L::load(lane_x), L::load(lane_y), L::load(lane_z), x, y, z);
+        rng.store(seeds + i);
+        store_vectors<L>(out + i, x, y, z);
+    }
+    for (; i < count; i++) {
+        float u = pcg_random_float(seeds[i]);
+        float v = pcg_random_float(seeds[i]);
+        out[i] = cosine_hemisphere_from_square(normals[i], u, v);
+    }
+}
+
+// Same math as pack_color, written over plain floats so the compiler can
+// vectorize it for the target. The clamp takes 0 when the square root is NaN,
+// like the max instructions of the vector versions do.
+inline void color_pack_scalar(const color *pixels, uint *output, float scale, int begin, int len) {
+    for (int i = begin; i < len; i++) {
+        const color &c = pixels[i];
+        uint r = static_cast<uint>(256 * std::min(std::max(0.0f, std::sqrt(c.x * scale)), 0.999f));
+        uint g = static_cast<uint>(256 * std::min(std::max(0.0f, std::sqrt(c.y * scale)), 0.999f));
+        uint b = static_cast<uint>(256 * std::min(std::max(0.0f, std::sqrt(c.z * scale)), 0.999f));
+        output[i] = (0xFFu << 24) | (b << 16) | (g << 8) | r;
+    }
+}
+
+#if KERNEL_ISA == KERNEL_ISA_SSE4
+// Gamma-corrects, clamps and scales one channel of four pixels to 0..255
+inline __m128i pack_channel(__m128 c, __m128 scale) {
+    __m128 v = _mm_sqrt_ps(_mm_mul_ps(c, scale));
+    v = _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), _mm_set1_ps(0.999f));
+    return _mm_cvttps_epi32(_mm_mul_ps(v, _mm_set1_ps(256)));
+}
+#elif KERNEL_ISA == KERNEL_ISA_AVX2
+inline __m256i pack_channel(__m256 c, __m256 scale) {
+    __m256 v = _mm256_sqrt_ps(_mm256_mul_ps(c, scale));
+    v = _mm256_min_ps(_mm256_max_ps(v, _mm256_setzero_ps()), _mm256_set1_ps(0.999f));
+    return _mm256_cvttps_epi32(_mm256_mul_ps(v, _mm256_set1_ps(256)));
+}
+#elif KERNEL_ISA == KERNEL_ISA_AVX512
+inline __m512i pack_channel(__m512 c, __m512 scale) {
+    __m512 v = _mm512_sqrt_ps(_mm512_mul_ps(c, scale));
+    v = _mm512_min_ps(_mm512_max_ps(v, _mm512_setzero_ps()), _mm512_set1_ps(0.999f));
+    return _mm512_cvttps_epi32(_mm512_mul_ps(v, _mm512_set1_ps(256)));
+}
+#endif
+
+// Packs every pixel the same way as color_pack_scalar. With `stream` the output is
+// written with non-temporal stores, which keep the frame from evicting the scene
+// out of the cache when nothing reads the pixels back soon.
+inline void color_pack(const color *pixels, uint *output, int samples_per_pixel, int len, bool stream) {
+    float scale = 1.0f / samples_per_pixel;
+    int i = 0;
+
+#if KERNEL_ISA == KERNEL_ISA_SSE4 || KERNEL_ISA == KERNEL_ISA_AVX2 || KERNEL_ISA == KERNEL_ISA_AVX512
+    // Streaming stores need aligned addresses, so pack a few pixels singly first
+    const int vector_bytes = KERNEL_ISA == KERNEL_ISA_SSE4 ? 16 : KERNEL_ISA == KERNEL_ISA_AVX2 ? 32 : 64;
+    if (stream) {
+        int head = (vector_bytes - reinterpret_cast<uintptr_t>(output) % vector_bytes) % vector_bytes / sizeof(uint);
+        i = std::min(head, len);
+        color_pack_scalar(pixels, output, scale, 0, i);
+    }
+#endif
+
+#if KERNEL_ISA == KERNEL_ISA_SSE4
+    const __m128 scales = _mm_set1_ps(scale);
+    const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xFF000000u));
+
+    for (; i + 4 <= len; i += 4) {
+        const float *p = reinterpret_cast<const float*>(pixels + i);
+        __m128 r = _mm_loadu_ps(p), g = _mm_loadu_ps(p + 4), b = _mm_loadu_ps(p + 8), pad = _mm_loadu_ps(p + 12);
+        _MM_TRANSPOSE4_PS(r, g, b, pad);
+
+        __m128i packed = _mm_or_si128(alpha, _mm_or_si128(
+            _mm_slli_epi32(pack_channel(b, scales), 16),
+            _mm_or_si128(_mm_slli_epi32(pack_channel(g, scales), 8), pack_channel(r, scales))));
+
+        if (stream)
+            _mm_stream_si128(reinterpret_cast<__m128i*>(output + i), packed);
+        else
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(output + i), packed);
+    }
+#elif KERNEL_ISA == KERNEL_ISA_AVX2
+    const __m256 scales = _mm256_set1_ps(scale);
+    const __m256i alpha = _mm256_set1_epi32(static_cast<int>(0xFF000000u));
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+    for (; i + 8 <= len; i += 8) {
+        const float *p = reinterpret_cast<const float*>(pixels + i);
+        __m256 v0 = _mm256_loadu_ps(p), v1 = _mm256_loadu_ps(p + 8);
+        __m256 v2 = _mm256_loadu_ps(p + 16), v3 = _mm256_loadu_ps(p + 24);
+
+        // A 4x4 transpose within each 128-bit half leaves pixel 2j+k's channel in slot 4k+j
+        __m256 t0 = _mm256_unpacklo_ps(v0, v1), t1 = _mm256_unpackhi_ps(v0, v1);
+        __m256 t2 = _mm256_unpacklo_ps(v2, v3), t3 = _mm256_unpackhi_ps(v2, v3);
+        __m256 r = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+        __m256 g = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+        __m256 b = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+
+        __m256i packed = _mm256_or_si256(alpha, _mm256_or_si256(
+            _mm256_slli_epi32(pack_channel(b, scales), 16),
+            _mm256_or_si256(_mm256_slli_epi32(pack_channel(g, scales), 8), pack_channel(r, scales))));
+        packed = _mm256_permutevar8x32_epi32(packed, order);
+
+        if (stream)
+            _mm256_stream_si256(reinterpret_cast<__m256i*>(output + i), packed);
+        else
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(output + i), packed);
+    }
+#elif KERNEL_ISA == KERNEL_ISA_AVX512
+    const __m512 scales = _mm512_set1_ps(scale);
+    const __m512i alpha = _mm512_set1_epi32(static_cast<int>(0xFF000000u));
+    const __m512i order = _mm512_setr_epi32(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+
+    for (; i + 16 <= len; i += 16) {
+        const float *p = reinterpret_cast<const float*>(pixels + i);
+        __m512 v0 = _mm512_loadu_ps(p), v1 = _mm512_loadu_ps(p + 16);
+        __m512 v2 = _mm512_loadu_ps(p + 32), v3 = _mm512_loadu_ps(p + 48);
+
+        // Same transpose as the AVX2 version, leaving pixel 4j+k's channel in slot 4k+j
+        __m512 t0 = _mm512_unpacklo_ps(v0, v1), t1 = _mm512_unpackhi_ps(v0, v1);
+        __m512 t2 = _mm512_unpacklo_ps(v2, v3), t3 = _mm512_unpackhi_ps(v2, v3);
+        __m512 r = _mm512_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+        __m512 g = _mm512_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+        __m512 b = _mm512_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+
+        __m512i packed = _mm512_or_si512(alpha, _mm512_or_si512(
+            _mm512_slli_epi32(pack_channel(b, scales), 16),
+            _mm512_or_si512(_mm512_slli_epi32(pack_channel(g, scales), 8), pack_channel(r, scales))));
+        packed = _mm512_permutexvar_epi32(order, packed);
+
+        if (stream)
+            _mm512_stream_si512(reinterpret_cast<__m512i*>(output + i), packed);
+        else
+            _mm512_storeu_si512(reinterpret_cast<__m512i*>(output + i), packed);
+    }
+#elif KERNEL_ISA == KERNEL_ISA_NEON
+    float32x4_t lower = vdupq_n_f32(0.0f);
+    float32x4_t upper = vdupq_n_f32(0.999f);
+    float32x4_t scales = vdupq_n_f32(scale);
+    uint32x4_t red, green, blue, alpha;
+
+    for (; i + 4 <= len; i += 4) {
+        float32x4x4_t color = vld4q_f32((const float *)&pixels[i]);
+        for (int n = 0; n < 4; n++) {
+            color.val[n] = vsqrtq_f32(vmulq_f32(color.val[n], scales));
+        }
+
+        red   = vcvtq_u32_f32(vmulq_n_f32(vminq_f32(vmaxq_f32(color.val[0], lower), upper), 256));
+        green = vcvtq_u32_f32(vmulq_n_f32(vminq_f32(vmaxq_f32(color.val[1], lower), upper), 256));
+        blue  = vcvtq_u32_f32(vmulq_n_f32(vminq_f32(vmaxq_f32(color.val[2], lower), upper), 256));
+        alpha = vdupq_n_u32(0xFF);
+
+        uint32x4_t packed = vorrq_u32(vshlq_n_u32(alpha, 24), vorrq_u32(vshlq_n_u32(blue, 16), vorrq_u32(vshlq_n_u32(green, 8), red)));
+
+        vst1q_u32(&output[i], packed);
+    }
+#endif
+
+    color_pack_scalar(pixels, output, scale, i, len);
+
+#if KERNEL_ISA == KERNEL_ISA_SSE4 || KERNEL_ISA == KERNEL_ISA_AVX2 || KERNEL_ISA == KERNEL_ISA_AVX512
+    if (stream)
+        _mm_sfence();
+#endif
+}
+
+// Each shader handles a whole group of hits on one material type and appends the
+// paths that keep going to `next`, with their seeds advanced past what they drew.
+// The material is known, so nothing is virtual. The lambertian bounce directions
+// are drawn for a vector's worth of paths at once.
+inline void shade_lambertian(const WavefrontQueues &queues, const std::vector<material*> &materials, std::vector<path_state> &next) {
+    const int width = KERNEL_LANES::width;
+    const std::vector<uint32_t> &group = queues.by_material[static_cast<int>(material_type::lambertian)];
+    simd::uint1 seeds[width];
+    vec3 normals[width];
+    vec3 directions[width];
+
+    for (size_t begin = 0; begin < group.size(); begin += width) {
+        int count = std::min<size_t>(width, group.size() - begin);
+        for (int k = 0; k < count; k++) {
+            seeds[k] = queues.paths[group[begin + k]].seed;
+            normals[k] = queues.recs[group[begin + k]].normal;
+        }
+        random_cosine_directions(seeds, normals, directions, count);
+
+        for (int k = 0; k < count; k++) {
+            const path_state &path = queues.paths[group[begin + k]];
+            const hit_record &rec = queues.recs[group[begin + k]];
+            const lambertian *mat = static_cast<const lambertian*>(materials[rec.mat_id]);
+
+            next.push_back(path_state {
+                .r = ray(rec.p, directions[k]),
+                .throughput = path.throughput * mat->albedo,
+                .pixel = path.pixel,
+                .path_seed = path.path_seed,
+                .seed = seeds[k],
+            });
+        }
+    }
+}
+
+inline void shade_metal(const WavefrontQueues &queues, const std::vector<material*> &materials, std::vector<path_state> &next) {
+    for (uint32_t i : queues.by_material[static_cast<int>(material_type::metal)]) {
+        const path_state &path = queues.paths[i];
+        const hit_record &rec = queues.recs[i];
+        const metal *mat = static_cast<const metal*>(materials[rec.mat_id]);
+
+        next.push_back(path_state {
+            .r = ray(rec.p, simd::reflect(path.r.direction(), rec.normal)),
+            .throughput = path.throughput * mat->albedo,
+            .pixel = path.pixel,
+            .path_seed = path.path_seed,
+            .seed = path.seed,
+        });
+    }
+}
+
+} // namespace KERNEL_NAMESPACE
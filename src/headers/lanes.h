@@ -0,0 +1,230 @@
+#pragma once
+
+// Thin wrappers over the SIMD registers of each instruction set so kernels can be
+// written once as templates over the lane type. f32 holds floats and u32 unsigned
+// 32-bit integers, one per lane. The x86 sets are always
+// defined, each compiled for its own target, and kernels.h picks between them at
+// runtime.
+
+#include "isa.h"
+
+#if ISA_X86
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include <cmath>
+#include <cstdint>
+
+#if ISA_X86
+ISA_TARGET_PUSH(ISA_TARGET_AVX512)
+struct lanes_avx512 {
+    static const int width = 16;
+    using f32 = __m512;
+    using mask = __mmask16;
+
+    static f32 set1(float x) { return _mm512_set1_ps(x); }
+    static f32 load(const float *p) { return _mm512_loadu_ps(p); }
+    static void store(float *p, f32 a) { _mm512_storeu_ps(p, a); }
+    static f32 iota() { return _mm512_setr_ps(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15); }
+
+    static f32 add(f32 a, f32 b) { return _mm512_add_ps(a, b); }
+    static f32 sub(f32 a, f32 b) { return _mm512_sub_ps(a, b); }
+    static f32 mul(f32 a, f32 b) { return _mm512_mul_ps(a, b); }
+    static f32 div(f32 a, f32 b) { return _mm512_div_ps(a, b); }
+    static f32 sqrt(f32 a) { return _mm512_sqrt_ps(a); }
+    static f32 min(f32 a, f32 b) { return _mm512_min_ps(a, b); }
+    static f32 max(f32 a, f32 b) { return _mm512_max_ps(a, b); }
+
+    static mask lt(f32 a, f32 b) { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+    static mask le(f32 a, f32 b) { return _mm512_cmp_ps_mask(a, b, _CMP_LE_OQ); }
+    static mask both(mask a, mask b) { return a & b; }
+    static mask either(mask a, mask b) { return a | b; }
+    static f32 select(mask m, f32 a, f32 b) { return _mm512_mask_blend_ps(m, b, a); }
+    static int bits(mask m) { return m; }
+
+    using u32 = __m512i;
+    static u32 set1_u32(uint32_t x) { return _mm512_set1_epi32(x); }
+    static u32 load_u32(const uint32_t *p) { return _mm512_loadu_si512(p); }
+    static void store_u32(uint32_t *p, u32 a) { _mm512_storeu_si512(p, a); }
+    static u32 add_u32(u32 a, u32 b) { return _mm512_add_epi32(a, b); }
+    static u32 mul_u32(u32 a, u32 b) { return _mm512_mullo_epi32(a, b); }
+    static u32 xor_u32(u32 a, u32 b) { return _mm512_xor_si512(a, b); }
+    static u32 srl(u32 a, int n) { return _mm512_srl_epi32(a, _mm_cvtsi32_si128(n)); }
+    static u32 srlv(u32 a, u32 n) { return _mm512_srlv_epi32(a, n); }
+    static u32 select_u32(mask m, u32 a, u32 b) { return _mm512_mask_blend_epi32(m, b, a); }
+    static f32 to_f32(u32 a) { return _mm512_cvtepi32_ps(a); }
+};
+ISA_TARGET_POP()
+
+ISA_TARGET_PUSH(ISA_TARGET_AVX2)
+struct lanes_avx2 {
+    static const int width = 8;
+    using f32 = __m256;
+    using mask = __m256;
+
+    static f32 set1(float x) { return _mm256_set1_ps(x); }
+    static f32 load(const float *p) { return _mm256_loadu_ps(p); }
+    static void store(float *p, f32 a) { _mm256_storeu_ps(p, a); }
+    static f32 iota() { return _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7); }
+
+    static f32 add(f32 a, f32 b) { return _mm256_add_ps(a, b); }
+    static f32 sub(f32 a, f32 b) { return _mm256_sub_ps(a, b); }
+    static f32 mul(f32 a, f32 b) { return _mm256_mul_ps(a, b); }
+    static f32 div(f32 a, f32 b) { return _mm256_div_ps(a, b); }
+    static f32 sqrt(f32 a) { return _mm256_sqrt_ps(a); }
+    static f32 min(f32 a, f32 b) { return _mm256_min_ps(a, b); }
+    static f32 max(f32 a, f32 b) { return _mm256_max_ps(a, b); }
+
+    static mask lt(f32 a, f32 b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+    static mask le(f32 a, f32 b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+    static mask both(mask a, mask b) { return _mm256_and_ps(a, b); }
+    static mask either(mask a, mask b) { return _mm256_or_ps(a, b); }
+    static f32 select(mask m, f32 a, f32 b) { return _mm256_blendv_ps(b, a, m); }
+    static int bits(mask m) { return _mm256_movemask_ps(m); }
+
+    using u32 = __m256i;
+    static u32 set1_u32(uint32_t x) { return _mm256_set1_epi32(x); }
+    static u32 load_u32(const uint32_t *p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+    static void store_u32(uint32_t *p, u32 a) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), a); }
+    static u32 add_u32(u32 a, u32 b) { return _mm256_add_epi32(a, b); }
+    static u32 mul_u32(u32 a, u32 b) { return _mm256_mullo_epi32(a, b); }
+    static u32 xor_u32(u32 a, u32 b) { return _mm256_xor_si256(a, b); }
+    static u32 srl(u32 a, int n) { return _mm256_srl_epi32(a, _mm_cvtsi32_si128(n)); }
+    static u32 srlv(u32 a, u32 n) { return _mm256_srlv_epi32(a, n); }
+    static u32 select_u32(mask m, u32 a, u32 b) { return _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(b), _mm256_castsi256_ps(a), m)); }
+    static f32 to_f32(u32 a) { return _mm256_cvtepi32_ps(a); }
+};
+ISA_TARGET_POP()
+
+ISA_TARGET_PUSH(ISA_TARGET_SSE4)
+struct lanes_sse4 {
+    static const int width = 4;
+    using f32 = __m128;
+    using mask = __m128;
+
+    static f32 set1(float x) { return _mm_set1_ps(x); }
+    static f32 load(const float *p) { return _mm_loadu_ps(p); }
+    static void store(float *p, f32 a) { _mm_storeu_ps(p, a); }
+    static f32 iota() { return _mm_setr_ps(0, 1, 2, 3); }
+
+    static f32 add(f32 a, f32 b) { return _mm_add_ps(a, b); }
+    static f32 sub(f32 a, f32 b) { return _mm_sub_ps(a, b); }
+    static f32 mul(f32 a, f32 b) { return _mm_mul_ps(a, b); }
+    static f32 div(f32 a, f32 b) { return _mm_div_ps(a, b); }
+    static f32 sqrt(f32 a) { return _mm_sqrt_ps(a); }
+    static f32 min(f32 a, f32 b) { return _mm_min_ps(a, b); }
+    static f32 max(f32 a, f32 b) { return _mm_max_ps(a, b); }
+
+    static mask lt(f32 a, f32 b) { return _mm_cmplt_ps(a, b); }
+    static mask le(f32 a, f32 b) { return _mm_cmple_ps(a, b); }
+    static mask both(mask a, mask b) { return _mm_and_ps(a, b); }
+    static mask either(mask a, mask b) { return _mm_or_ps(a, b); }
+    static f32 select(mask m, f32 a, f32 b) { return _mm_blendv_ps(b, a, m); }
+    static int bits(mask m) { return _mm_movemask_ps(m); }
+
+    using u32 = __m128i;
+    static u32 set1_u32(uint32_t x) { return _mm_set1_epi32(x); }
+    static u32 load_u32(const uint32_t *p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+    static void store_u32(uint32_t *p, u32 a) { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), a); }
+    static u32 add_u32(u32 a, u32 b) { return _mm_add_epi32(a, b); }
+    static u32 mul_u32(u32 a, u32 b) { return _mm_mullo_epi32(a, b); }
+    static u32 xor_u32(u32 a, u32 b) { return _mm_xor_si128(a, b); }
+    static u32 srl(u32 a, int n) { return _mm_srl_epi32(a, _mm_cvtsi32_si128(n)); }
+    static u32 select_u32(mask m, u32 a, u32 b) { return _mm_castps_si128(_mm_blendv_ps(_mm_castsi128_ps(b), _mm_castsi128_ps(a), m)); }
+    static f32 to_f32(u32 a) { return _mm_cvtepi32_ps(a); }
+
+    // No per-lane shift before AVX2, so shift by each bit of the counts in turn
+    static u32 srlv(u32 a, u32 n) {
+        for (int bit = 1; bit < 32; bit <<= 1) {
+            __m128i set = _mm_cmpeq_epi32(_mm_and_si128(n, _mm_set1_epi32(bit)), _mm_set1_epi32(bit));
+            a = _mm_blendv_epi8(a, srl(a, bit), set);
+        }
+        return a;
+    }
+};
+ISA_TARGET_POP()
+#endif
+
+#if defined(__ARM_NEON)
+struct lanes_neon {
+    static const int width = 4;
+    using f32 = float32x4_t;
+    using mask = uint32x4_t;
+
+    static f32 set1(float x) { return vdupq_n_f32(x); }
+    static f32 load(const float *p) { return vld1q_f32(p); }
+    static void store(float *p, f32 a) { vst1q_f32(p, a); }
+    static f32 iota() { static const float i[4] = { 0, 1, 2, 3 }; return vld1q_f32(i); }
+
+    static f32 add(f32 a, f32 b) { return vaddq_f32(a, b); }
+    static f32 sub(f32 a, f32 b) { return vsubq_f32(a, b); }
+    static f32 mul(f32 a, f32 b) { return vmulq_f32(a, b); }
+    static f32 div(f32 a, f32 b) { return vdivq_f32(a, b); }
+    static f32 sqrt(f32 a) { return vsqrtq_f32(a); }
+    static f32 min(f32 a, f32 b) { return vminq_f32(a, b); }
+    static f32 max(f32 a, f32 b) { return vmaxq_f32(a, b); }
+
+    static mask lt(f32 a, f32 b) { return vcltq_f32(a, b); }
+    static mask le(f32 a, f32 b) { return vcleq_f32(a, b); }
+    static mask both(mask a, mask b) { return vandq_u32(a, b); }
+    static mask either(mask a, mask b) { return vorrq_u32(a, b); }
+    static f32 select(mask m, f32 a, f32 b) { return vbslq_f32(m, a, b); }
+    static int bits(mask m) {
+        static const uint32_t weights[4] = { 1, 2, 4, 8 };
+        return vaddvq_u32(vandq_u32(m, vld1q_u32(weights)));
+    }
+
+    using u32 = uint32x4_t;
+    static u32 set1_u32(uint32_t x) { return vdupq_n_u32(x); }
+    static u32 load_u32(const uint32_t *p) { return vld1q_u32(p); }
+    static void store_u32(uint32_t *p, u32 a) { vst1q_u32(p, a); }
+    static u32 add_u32(u32 a, u32 b) { return vaddq_u32(a, b); }
+    static u32 mul_u32(u32 a, u32 b) { return vmulq_u32(a, b); }
+    static u32 xor_u32(u32 a, u32 b) { return veorq_u32(a, b); }
+    static u32 srl(u32 a, int n) { return vshlq_u32(a, vdupq_n_s32(-n)); }
+    static u32 srlv(u32 a, u32 n) { return vshlq_u32(a, vnegq_s32(vreinterpretq_s32_u32(n))); }
+    static u32 select_u32(mask m, u32 a, u32 b) { return vbslq_u32(m, a, b); }
+    static f32 to_f32(u32 a) { return vcvtq_f32_u32(a); }
+};
+#endif
+
+struct lanes_scalar {
+    static const int width = 1;
+    using f32 = float;
+    using mask = bool;
+
+    static f32 set1(float x) { return x; }
+    static f32 load(const float *p) { return *p; }
+    static void store(float *p, f32 a) { *p = a; }
+    static f32 iota() { return 0; }
+
+    static f32 add(f32 a, f32 b) { return a + b; }
+    static f32 sub(f32 a, f32 b) { return a - b; }
+    static f32 mul(f32 a, f32 b) { return a * b; }
+    static f32 div(f32 a, f32 b) { return a / b; }
+    static f32 sqrt(f32 a) { return std::sqrt(a); }
+    static f32 min(f32 a, f32 b) { return a < b ? a : b; }
+    static f32 max(f32 a, f32 b) { return a > b ? a : b; }
+
+    static mask lt(f32 a, f32 b) { return a < b; }
+    static mask le(f32 a, f32 b) { return a <= b; }
+    static mask both(mask a, mask b) { return a && b; }
+    static mask either(mask a, mask b) { return a || b; }
+    static f32 select(mask m, f32 a, f32 b) { return m ? a : b; }
+    static int bits(mask m) { return m; }
+
+    using u32 = uint32_t;
+    static u32 set1_u32(uint32_t x) { return x; }
+    static u32 load_u32(const uint32_t *p) { return *p; }
+    static void store_u32(uint32_t *p, u32 a) { *p = a; }
+    static u32 add_u32(u32 a, u32 b) { return a + b; }
+    static u32 mul_u32(u32 a, u32 b) { return a * b; }
+    static u32 xor_u32(u32 a, u32 b) { return a ^ b; }
+    static u32 srl(u32 a, int n) { return a >> n; }
+    static u32 srlv(u32 a, u32 n) { return a >> n; }
+    static u32 select_u32(mask m, u32 a, u32 b) { return m ? a : b; }
+    static f32 to_f32(u32 a) { return static_cast<f32>(a); }
+};
@@ -4,19 +4,35 @@
 #include "util.h"
 
 
+// Lets batched shading group hits by material without a virtual call per hit
+enum class material_type {
+    none,
+    lambertian,
+    metal,
+};
+const int MATERIAL_TYPE_COUNT = 3;
+
 class material {
 public:
+    material(material_type type = material_type::none) : type(type) {}
     virtual ~material() = default;
 
-    // scatter based on the cstdlib rand()
+    // scatter drawing from the pixel's own pcg32 stream
+    virtual bool scatter(
+        const ray &r_in, const hit_record &rec, color &attenuation, ray &scattered, pcg32 &rng) const {
+        return false;
+    }
+
+    // scatter based on the pcg hashing function, advancing seed past what it draws
     virtual bool scatter(
-        const ray &r_in, const hit_record &rec, color &attenuation, ray &scattered) const {
+        const ray &r_in, const hit_record &rec, color &attenuation, ray &scattered, simd::uint1 &seed)
+    const {
         return false;
     }
 
-    // scatter based on the pcg hashing function
+    // scatter with a point of the unit square the caller already drew, e.g. from a sampler
     virtual bool scatter(
-        const ray &r_in, const hit_record &rec, color &attenuation, ray &scattered, uint seed)
+        const ray &r_in, const hit_record &rec, color &attenuation, ray &scattered, float u, float v)
     const {
         return false;
     }
@@ -24,44 +40,50 @@ public:
     virtual color get_color() const { return simd::make_float3(0, 0, 0); }
     virtual bool set_color(const color &in) { return false; }
     virtual const char *type_name() const { return "material"; }
+    virtual std::shared_ptr<material> clone() const { return std::make_shared<material>(*this); }
+
+public:
+    const material_type type;
 };
 
 class lambertian : public material {
 public:
 
-    lambertian(const color &albedo) : albedo(albedo) {}
+    lambertian(const color &albedo) : material(material_type::lambertian), albedo(albedo) {}
 
     bool scatter(
-        const ray &r_in, const hit_record &rec, color &attenuation, ray &scattered) 
+        const ray &r_in, const hit_record &rec, color &attenuation, ray &scattered, pcg32 &rng) 
     const override {
-
-        auto scatter_direction = rec.normal + random_unit_vector();
-
-        if (near_zero(scatter_direction))
-            scatter_direction = rec.normal;
-
-        scattered = ray(rec.p, scatter_direction);
-        attenuation = albedo;
-        return true;
+        float u = random_float(rng);
+        float v = random_float(rng);
+        return scatter(r_in, rec, attenuation, scattered, u, v);
     }
 
     bool scatter(
-        const ray &r_in, const hit_record &rec, color &attenuation, ray &scattered, uint seed) 
+        const ray &r_in, const hit_record &rec, color &attenuation, ray &scattered, simd::uint1 &seed) 
     const override {
+        float u = pcg_random_float(seed);
+        float v = pcg_random_float(seed);
+        return scatter(r_in, rec, attenuation, scattered, u, v);
+    }
 
-        auto scatter_direction = rec.normal + pcg_unit_vector(seed);
-
-        if (near_zero(scatter_direction))
-            scatter_direction = rec.normal;
-
-        scattered = ray(rec.p, scatter_direction);
+    bool scatter(
+        const ray &r_in, const hit_record &rec, color &attenuation, ray &scattered, float u, float v) 
+    const override {
+        scattered = ray(rec.p, scatter_direction(rec, u, v));
         attenuation = albedo;
         return true;
     }
 
+    // Cosine-weighted bounce around the normal, drawn without rejection
+    static vec3 scatter_direction(const hit_record &rec, float u, float v) {
+        return cosine_hemisphere_from_square(rec.normal, u, v);
+    }
+
     color get_color() const override { return albedo; }
     bool set_color(const color &in) override { albedo = in; return true; }
     const char *type_name() const override { return "lambertian"; }
+    std::shared_ptr<material> clone() const override { return std::make_shared<lambertian>(*this); }
 
 public:
     color albedo;
@@ -71,10 +93,19 @@ public:
 class metal : public material {
 public:
 
-    metal(const color &albedo) : albedo(albedo) {}
+    metal(const color &albedo) : material(material_type::metal), albedo(albedo) {}
+
+    bool scatter(
+        const ray &r_in, const hit_record &rec, color &attenuation, ray &scattered, pcg32 &rng) 
+    const override {
+        auto reflected = simd::reflect(r_in.direction(), rec.normal);
+        scattered = ray(rec.p, reflected);
+        attenuation = albedo;
+        return true;
+    }
 
     bool scatter(
-        const ray &r_in, const hit_record &rec, color &attenuation, ray &scattered) 
+        const ray &r_in, const hit_record &rec, color &attenuation, ray &scattered, simd::uint1 &seed) 
     const override {
         auto reflected = simd::reflect(r_in.direction(), rec.normal);
         scattered = ray(rec.p, reflected);
@@ -83,7 +114,7 @@ public:
     }
 
     bool scatter(
-        const ray &r_in, const hit_record &rec, color &attenuation, ray &scattered, uint seed) 
+        const ray &r_in, const hit_record &rec, color &attenuation, ray &scattered, float u, float v) 
     const override {
         auto reflected = simd::reflect(r_in.direction(), rec.normal);
         scattered = ray(rec.p, reflected);
@@ -94,6 +125,7 @@ public:
     color get_color() const override { return albedo; }
     bool set_color(const color &in) override { albedo = in; return true; }
     const char *type_name() const override { return "metal"; }
+    std::shared_ptr<material> clone() const override { return std::make_shared<metal>(*this); }
 
 public:
     color albedo;
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "util.h"
+#include "aabb.h"
+
+#include <cstdint>
+
+// Primary rays are traced in square blocks of PACKET_DIM x PACKET_DIM pixels
+const int PACKET_DIM = 4;
+const int PACKET_SIZE = PACKET_DIM * PACKET_DIM;
+
+// Rays that leave the camera together and get traced through the scene together.
+// When every ray shares an origin the packet also carries the four side planes of
+// the frustum around them, which lets whole subtrees be skipped with one test.
+struct ray_packet {
+    ray rays[PACKET_SIZE];
+    vec3 inv_dir[PACKET_SIZE];
+    simd::float1 t_max[PACKET_SIZE];
+    uint32_t active = 0;
+
+    bool has_frustum = false;
+    point3 frustum_origin;
+    vec3 frustum_normals[4];
+
+    inline void set_frustum(const point3& origin, const vec3 corners[4]);
+    inline bool outside_frustum(const aabb& box) const;
+};
+
+// `corners` are the directions of the packet's extreme rays, in order around its edge
+inline void ray_packet::set_frustum(const point3& origin, const vec3 corners[4]) {
+    vec3 middle = corners[0] + corners[1] + corners[2] + corners[3];
+
+    frustum_origin = origin;
+    for (int i = 0; i < 4; i++) {
+        vec3 n = simd::cross(corners[i], corners[(i + 1) % 4]);
+        frustum_normals[i] = simd::dot(n, middle) < 0 ? -n : n;
+    }
+    has_frustum = true;
+}
+
+// True if the box lies entirely behind one of the side planes, so no ray in the packet can reach it
+inline bool ray_packet::outside_frustum(const aabb& box) const {
+    if (!has_frustum)
+        return false;
+
+    for (int i = 0; i < 4; i++) {
+        const vec3& n = frustum_normals[i];
+        // The corner furthest along the plane normal
+        point3 corner = simd::make_float3(
+            n.x > 0 ? box.maximum.x : box.minimum.x,
+            n.y > 0 ? box.maximum.y : box.minimum.y,
+            n.z > 0 ? box.maximum.z : box.minimum.z
+        );
+        if (simd::dot(n, corner - frustum_origin) < 0)
+            return true;
+    }
+    return false;
+}
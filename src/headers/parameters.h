@@ -0,0 +1,100 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#include "util.h"
+#include "sampler.h"
+
+// Rays traced and time spent tracing them this frame, split into camera rays and
+// the rays that bounce off whatever those hit
+struct RayStats {
+    std::atomic<uint64_t> primary_rays{0};
+    std::atomic<uint64_t> secondary_rays{0};
+    std::atomic<uint64_t> primary_ns{0};
+    std::atomic<uint64_t> secondary_ns{0};
+
+    void reset() {
+        primary_rays = 0;
+        secondary_rays = 0;
+        primary_ns = 0;
+        secondary_ns = 0;
+    }
+
+    // Every path starts with one camera ray, so this is rays traced per path
+    double average_path_length() const {
+        return primary_rays > 0 ? double(primary_rays + secondary_rays) / primary_rays : 0;
+    }
+
+    void assign(const RayStats &other) {
+        primary_rays = other.primary_rays.load();
+        secondary_rays = other.secondary_rays.load();
+        primary_ns = other.primary_ns.load();
+        secondary_ns = other.secondary_ns.load();
+    }
+};
+
+// How a frame is rendered. Every frame handed to the worker threads keeps its own
+// copy, so the menus can change these while it is being traced.
+struct RenderSettings {
+    int samples_per_pixel = 1;
+
+    // Paths stop after max_depth rays. From rr_depth bounces on they can also be
+    // ended early by Russian roulette.
+    int max_depth = 50;
+    int rr_depth = 3;
+
+    // Trace camera rays in PACKET_DIM x PACKET_DIM packets in the PCG renderer
+    bool packet_primary = true;
+
+    // Pack the frame with non-temporal stores
+    bool stream_pack = false;
+
+    // Where the regular and PCG renderers take pixel jitter and bounce samples from
+    sampler_type sampler = sampler_type::white;
+};
+
+struct Parameters : RenderSettings {
+    Parameters(int width, int height) 
+        : tex_width(width), tex_height(height) {}
+    ~Parameters() {
+        delete[] buffer; 
+        delete[] color_buffer;
+        delete[] accum_buffer;
+    }
+
+    int tex_width, tex_height;
+    uint *buffer = new uint[tex_width*tex_height]();
+    color *color_buffer = new color[tex_width*tex_height]();
+    color *accum_buffer = new color[tex_width*tex_height]();
+
+    bool switched = false;
+    int render_type = 0;
+
+    // accum_buffer holds the sum of every frame since the scene last changed.
+    // Anything that changes the image sets scene_changed to start the sum over.
+    bool accumulate = true;
+    bool scene_changed = false;
+    int accumulated_frames = 0;
+    int accumulated_samples = 0;
+
+    // Pack the frame straight into the locked SDL texture instead of into buffer
+    bool zero_copy = true;
+
+    // Where resolve_tile packs this frame's pixels, pack_pitch pixels per row. The
+    // main loop points it at the texture or at buffer before rendering.
+    uint *pack_target = nullptr;
+    int pack_pitch = 0;
+
+    // Frames the worker threads may run ahead of the one on screen in the
+    // multi-threaded mode. 1 renders and shows every frame in turn.
+    int frame_latency = 2;
+
+    // Trace the multi-threaded mode continuously on its own threads, so the UI keeps
+    // running at display rate and shows the newest frame whenever one is finished.
+    // traced_ms is how long that frame took.
+    bool decoupled = true;
+    double traced_ms = 0;
+
+    RayStats ray_stats;
+};
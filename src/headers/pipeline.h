@@ -0,0 +1,343 @@
+#pragma once
+
+#include "parameters.h"
+#include "thread.h"
+#include "tracer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+const int MAX_FRAME_LATENCY = 3;
+
+// Copies of the scene for the worker threads. A copy the workers have let go of is
+// brought up to date with Scene::update_snapshot, which refits its BVH, rather than
+// copied and rebuilt from scratch; a new copy is only taken while every other one is
+// still being rendered, or when the scene changed shape.
+class SnapshotPool {
+public:
+    shared_ptr<Scene> acquire(const Scene &scene) {
+        for (auto &copy : copies) {
+            if (copy.use_count() != 1)
+                continue;
+
+            // The last worker let go of it; see everything that worker did first
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (!scene.update_snapshot(*copy))
+                copy = scene.snapshot();
+            return copy;
+        }
+        copies.push_back(scene.snapshot());
+        return copies.back();
+    }
+
+private:
+    std::vector<shared_ptr<Scene>> copies;
+};
+
+// A frame handed to the worker threads, with everything they read while tracing
+// it, so the main thread can edit the live scene and settings in the meantime
+struct FrameSlot {
+    shared_ptr<Scene> scene;
+    camera cam { 1 };
+    RenderSettings settings;
+    int accumulated_frames = 0;
+    int accumulated_samples = 0;
+
+    // Where the frame is packed, pitch pixels per row: `pixels` unless the caller
+    // passed a target of its own
+    uint *packed = nullptr;
+    int pitch = 0;
+    std::unique_ptr<uint[]> pixels;
+
+    RayStats ray_stats;
+};
+
+// Keeps up to `latency` frames queued for the worker threads. A tracer thread feeds
+// them to a ThreadManager one after the other, and each worker accumulates and packs
+// its own tiles, so while the main thread presents one frame the workers are already
+// tracing the next. All frames accumulate into one buffer, in the order queued.
+class FramePipeline {
+public:
+    FramePipeline(int tex_width, int tex_height, int workers = std::thread::hardware_concurrency())
+        : params(tex_width, tex_height), threads(tex_width, tex_height, workers)
+    {
+        for (auto &slot : slots)
+            slot.pixels.reset(new uint[tex_width * tex_height]());
+
+        threads.threads_init([this](const RenderTask &task) {
+            pcg_render(*current->scene, current->cam, params, task);
+            resolve_tile(params, task);
+        });
+        tracer = std::thread(&FramePipeline::trace_frames, this);
+    }
+
+    ~FramePipeline() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            shutting_down = true;
+        }
+        cv.notify_all();
+        tracer.join();
+    }
+
+    // Queues a frame of `scene` with the settings and accumulation counters of
+    // `parameters`. Once `latency` frames are queued it returns the oldest, waiting
+    // for it to finish; until then it returns nullptr. The frame stays valid until
+    // the next call. With a latency of 1 the frame is packed into `target`, if given,
+    // since it is finished before this returns.
+    const FrameSlot *advance(shared_ptr<Scene> scene, const camera &cam, const Parameters &parameters,
+                             uint *target = nullptr, int pitch = 0) {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        // The slot shown last time is the only one that can share this index
+        FrameSlot &slot = slots[submitted % MAX_FRAME_LATENCY];
+        slot.scene = std::move(scene);
+        slot.cam = cam;
+        slot.settings = parameters;
+        slot.accumulated_frames = parameters.accumulated_frames;
+        slot.accumulated_samples = parameters.accumulated_samples;
+        bool direct = target && frame_latency == 1;
+        slot.packed = direct ? target : slot.pixels.get();
+        slot.pitch = direct ? pitch : params.tex_width;
+        submitted++;
+        cv.notify_all();
+
+        if (submitted - presented < (uint64_t)frame_latency)
+            return nullptr;
+
+        cv.wait(lock, [&]{ return traced > presented; });
+        return &slots[presented++ % MAX_FRAME_LATENCY];
+    }
+
+    // Drops every queued frame once it is traced, then changes the latency
+    void set_latency(int frames) {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&]{ return traced == submitted; });
+        presented = submitted;
+        frame_latency = std::clamp(frames, 1, MAX_FRAME_LATENCY);
+    }
+
+    int latency() const { return frame_latency; }
+
+    // Settings and buffers of the frame being traced; only the tracer thread writes them
+    Parameters params;
+    ThreadManager threads;
+
+private:
+    void trace_frames() {
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [&]{ return shutting_down || traced < submitted; });
+                if (shutting_down)
+                    return;
+                current = &slots[traced % MAX_FRAME_LATENCY];
+            }
+
+            static_cast<RenderSettings&>(params) = current->settings;
+            params.accumulated_frames = current->accumulated_frames;
+            params.accumulated_samples = current->accumulated_samples;
+            params.pack_target = current->packed;
+            params.pack_pitch = current->pitch;
+            params.ray_stats.reset();
+
+            threads.push_tasks();
+            threads.wait_for_completion();
+            current->ray_stats.assign(params.ray_stats);
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                traced++;
+            }
+            cv.notify_all();
+        }
+    }
+
+    FrameSlot slots[MAX_FRAME_LATENCY];
+    FrameSlot *current = nullptr;
+    int frame_latency = 2;
+
+    // Frames queued, finished by the workers and handed back by advance, in order
+    uint64_t submitted = 0;
+    uint64_t traced = 0;
+    uint64_t presented = 0;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool shutting_down = false;
+    std::thread tracer;
+};
+
+// Lock-free triple buffer handing the newest T from one writer thread to one reader
+// thread. The writer fills back() and publishes it; the reader calls update() to
+// take the newest published T, if any, and reads it through front(). Neither side
+// ever waits for the other, and a T the reader never took is simply overwritten.
+template<typename T>
+class TripleBuffer {
+public:
+    template<typename... Args>
+    TripleBuffer(const Args&... args) : slots{ T(args...), T(args...), T(args...) } {}
+
+    T &back() { return slots[back_index]; }
+    T &front() { return slots[front_index]; }
+
+    void publish() {
+        uint8_t previous = middle.exchange(back_index | FRESH, std::memory_order_acq_rel);
+        back_index = previous & INDEX;
+    }
+
+    // Returns whether front() changed
+    bool update() {
+        if (!(middle.load(std::memory_order_relaxed) & FRESH))
+            return false;
+        uint8_t previous = middle.exchange(front_index, std::memory_order_acq_rel);
+        front_index = previous & INDEX;
+        return true;
+    }
+
+private:
+    static const uint8_t INDEX = 3;
+    static const uint8_t FRESH = 4;
+
+    T slots[3];
+    uint8_t back_index = 0;
+    uint8_t front_index = 1;
+    std::atomic<uint8_t> middle{2};
+};
+
+// What the UI thread wants traced. A new generation starts the accumulation over.
+struct FrameJob {
+    shared_ptr<Scene> scene;
+    camera cam { 1 };
+    RenderSettings settings;
+    bool accumulate = true;
+    uint64_t generation = 0;
+};
+
+// A finished frame, packed and ready to upload
+struct TracedFrame {
+    TracedFrame(int tex_width, int tex_height) : pixels(new uint[tex_width * tex_height]()) {}
+
+    std::unique_ptr<uint[]> pixels;
+    int accumulated_samples = 0;
+    double frame_ms = 0;
+    RayStats ray_stats;
+};
+
+// Traces frames back to back on its own threads, whatever the UI thread is doing.
+// The UI thread submits the scene and settings it wants through one triple buffer
+// and picks up the newest finished frame from another, so a slow frame never holds
+// up input, the menus or the vsync'd present, and edits reach the tracer at the
+// start of its next frame.
+class ContinuousTracer {
+public:
+    ContinuousTracer(int tex_width, int tex_height, int workers = std::thread::hardware_concurrency())
+        : params(tex_width, tex_height), threads(tex_width, tex_height, workers),
+          frames(tex_width, tex_height)
+    {
+        threads.threads_init([this](const RenderTask &task) {
+            pcg_render(*job->scene, job->cam, params, task);
+            resolve_tile(params, task);
+        });
+        tracer = std::thread(&ContinuousTracer::trace_frames, this);
+    }
+
+    ~ContinuousTracer() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            shutting_down = true;
+        }
+        cv.notify_all();
+        tracer.join();
+    }
+
+    // Pauses or resumes tracing. Paused, the worker threads sleep after the current frame.
+    void set_running(bool run) {
+        if (run == running)
+            return;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            running = run;
+        }
+        cv.notify_all();
+    }
+
+    // Hands the tracer what to draw from its next frame on. Never blocks.
+    void submit(shared_ptr<Scene> scene, const camera &cam, const Parameters &parameters, uint64_t generation) {
+        FrameJob &next = jobs.back();
+        next.scene = std::move(scene);
+        next.cam = cam;
+        next.settings = parameters;
+        next.accumulate = parameters.accumulate;
+        next.generation = generation;
+        jobs.publish();
+    }
+
+    // The newest finished frame, or nullptr if none was finished since the last call.
+    // It stays valid until the next call. Never blocks.
+    const TracedFrame *latest() {
+        return frames.update() ? &frames.front() : nullptr;
+    }
+
+    // Settings and buffers of the frame being traced; only the tracer thread writes them
+    Parameters params;
+    ThreadManager threads;
+
+private:
+    void trace_frames() {
+        uint64_t generation = 0;
+
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [&]{ return shutting_down || running; });
+                if (shutting_down)
+                    return;
+            }
+
+            jobs.update();
+            job = &jobs.front();
+            if (!job->scene) {
+                std::this_thread::yield();
+                continue;
+            }
+            if (job->generation != generation || !job->accumulate) {
+                params.accumulated_frames = 0;
+                params.accumulated_samples = 0;
+                generation = job->generation;
+            }
+
+            TracedFrame &out = frames.back();
+            static_cast<RenderSettings&>(params) = job->settings;
+            params.pack_target = out.pixels.get();
+            params.pack_pitch = params.tex_width;
+            params.ray_stats.reset();
+
+            auto start = NOW();
+            threads.push_tasks();
+            threads.wait_for_completion();
+
+            params.accumulated_frames++;
+            params.accumulated_samples += params.samples_per_pixel;
+            out.accumulated_samples = params.accumulated_samples;
+            out.frame_ms = GET_TIME(NOW(), start) * 1e3;
+            out.ray_stats.assign(params.ray_stats);
+            frames.publish();
+        }
+    }
+
+    TripleBuffer<FrameJob> jobs;
+    TripleBuffer<TracedFrame> frames;
+    FrameJob *job = nullptr;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool running = false;
+    bool shutting_down = false;
+    std::thread tracer;
+};
@@ -7,6 +7,7 @@
 #include <backends/imgui_impl_sdlrenderer2.h>
 
 #include "util.h"
+#include "color.h"
 
 #define ASSERT(_e, ...) if (!_e) { fprintf(stderr, __VA_ARGS__); exit(1); }
 
@@ -86,7 +87,9 @@ public:
     }
 
     void present() {
-        SDL_UpdateTexture(this->texture, NULL, this->pixels, this->tex_width * sizeof(uint));
+        if (!this->texture_current)
+            SDL_UpdateTexture(this->texture, NULL, this->pixels, this->tex_width * sizeof(uint));
+        this->texture_current = false;
 
         ImGui::Begin("Texture");
         ImGui::Image(reinterpret_cast<ImTextureID>(this->texture), ImVec2(this->window_width - 305, this->window_height - 70));
@@ -143,6 +146,37 @@ public:
         memcpy(this->pixels, pixels, (this->tex_width * this->tex_height) * sizeof(uint));
     }
 
+    // Uploads a packed frame for the next present without copying it into the buffer
+    void upload(const uint *frame) {
+        SDL_UpdateTexture(this->texture, NULL, frame, this->tex_width * sizeof(uint));
+        this->texture_current = true;
+    }
+
+    // Shows the texture as it is again at the next present
+    void keep_texture() {
+        this->texture_current = true;
+    }
+
+    // Maps the streaming texture so a frame can be packed straight into it, skipping
+    // the copies through set_buffer and SDL_UpdateTexture. Every texel has to be
+    // written before unlock_texture, and the next present shows them instead of the
+    // buffer. pitch is set to the length of a texture row in pixels.
+    uint* lock_texture(int &pitch) {
+        void *texels;
+        int pitch_bytes;
+        ASSERT(
+            !SDL_LockTexture(this->texture, NULL, &texels, &pitch_bytes),
+            "Texture failed to lock: %s\n",
+            SDL_GetError());
+        pitch = pitch_bytes / sizeof(uint);
+        return static_cast<uint*>(texels);
+    }
+
+    void unlock_texture() {
+        SDL_UnlockTexture(this->texture);
+        this->texture_current = true;
+    }
+
   
 private:
     SDL_Window *window = nullptr;
@@ -156,4 +190,10 @@ private:
     int tex_width, tex_height;
 
     int num_frames = 0;
+    bool texture_current = false;
 };
+
+void write_color(Renderer &renderer, color pixel_color, int samples_per_pixel, int x, int y) {
+    color pixel = set_color(pixel_color, samples_per_pixel);
+    renderer.set_pixel(x, y, pixel.x, pixel.y, pixel.z);
+}
@@ -0,0 +1,238 @@
+#pragma once
+
+#include "util.h"
+#include "vec3.h"
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Where the renderers take the random numbers of a sample from. White noise is
+// the per-path PCG streams; the others are low-discrepancy: their points cover the
+// pixel and the hemisphere more evenly, so the image reaches a given noise level
+// with fewer samples per pixel.
+enum class sampler_type {
+    white,
+    sobol,
+    lattice,
+    blue_noise,
+};
+const int SAMPLER_TYPE_COUNT = 4;
+
+inline const char *sampler_name(sampler_type type) {
+    switch (type) {
+        case sampler_type::sobol: return "sobol";
+        case sampler_type::lattice: return "lattice";
+        case sampler_type::blue_noise: return "blue-noise";
+        default: return "white";
+    }
+}
+
+// One sample of one pixel. `index` counts the pixel's samples since accumulation
+// started, so every frame continues the sequence where the last one stopped.
+struct pixel_sample {
+    sampler_type type;
+    simd::uint1 x, y;
+    simd::uint1 pixel;
+    simd::uint1 index;
+};
+
+// --------------------------------------Sobol-----------------------------------
+// Owen-scrambled Sobol points after Burley, "Practical Hash-based Owen Scrambling"
+// (JCGT 2020): every dimension pair takes the first two Sobol dimensions, with the
+// index shuffled and each coordinate scrambled by hashes of the pixel and pair, so
+// the pairs are decorrelated from each other and from neighbouring pixels.
+
+inline simd::uint1 reverse_bits(simd::uint1 x) {
+    x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+    x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+    x = ((x >> 4) & 0x0F0F0F0Fu) | ((x & 0x0F0F0F0Fu) << 4);
+    x = ((x >> 8) & 0x00FF00FFu) | ((x & 0x00FF00FFu) << 8);
+    return (x >> 16) | (x << 16);
+}
+
+inline simd::uint1 laine_karras_permutation(simd::uint1 x, simd::uint1 seed) {
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+}
+
+inline simd::uint1 nested_uniform_scramble(simd::uint1 x, simd::uint1 seed) {
+    return reverse_bits(laine_karras_permutation(reverse_bits(x), seed));
+}
+
+// The first Sobol dimension is the van der Corput sequence; the second has the
+// direction numbers v[i] = v[i-1] ^ (v[i-1] >> 1)
+inline simd::uint1 sobol_dim0(simd::uint1 index) {
+    return reverse_bits(index);
+}
+
+inline simd::uint1 sobol_dim1(simd::uint1 index) {
+    simd::uint1 result = 0;
+    for (simd::uint1 v = 0x80000000u; index; index >>= 1, v ^= v >> 1) {
+        if (index & 1)
+            result ^= v;
+    }
+    return result;
+}
+
+inline float to_unit_float(simd::uint1 bits) {
+    return (bits >> 8) * 0x1p-24f;
+}
+
+inline void sobol_2d(const pixel_sample &sample, simd::uint1 dim, float &u, float &v) {
+    simd::uint1 seed = pcg_hash(pcg_hash(sample.pixel) ^ dim);
+    simd::uint1 index = nested_uniform_scramble(sample.index, seed);
+    u = to_unit_float(nested_uniform_scramble(sobol_dim0(index), pcg_hash(seed ^ 1)));
+    v = to_unit_float(nested_uniform_scramble(sobol_dim1(index), pcg_hash(seed ^ 2)));
+}
+
+// -------------------------------------Lattice----------------------------------
+// Extensible rank-1 lattice: point i is the van der Corput radical inverse of i
+// times the generating vector (1, 182667), so any power-of-two prefix is a full
+// lattice. Each pixel and pair shifts it by its own random offset, modulo 1.
+inline void lattice_2d(const pixel_sample &sample, simd::uint1 dim, float &u, float &v) {
+    simd::uint1 seed = pcg_hash(pcg_hash(sample.pixel) ^ dim);
+    simd::uint1 phi = reverse_bits(sample.index);
+    u = to_unit_float(phi + pcg_hash(seed ^ 1));
+    v = to_unit_float(phi * 182667u + pcg_hash(seed ^ 2));
+}
+
+// ------------------------------------Blue noise--------------------------------
+// A BLUE_NOISE_SIZE x BLUE_NOISE_SIZE tileable mask of ranks in [0, 1) with no low
+// frequencies, made once with Ulichney's void-and-cluster method. Neighbouring
+// pixels read neighbouring texels, so their errors are spread out as fine
+// grain rather than clumps; each pair reads the mask at its own offset, and each
+// sample steps the pair along Roberts' R2 sequence (the 2-D golden ratio), so
+// successive samples of a pixel stay stratified over the square.
+const int BLUE_NOISE_SIZE = 64;
+
+class blue_noise_mask {
+public:
+    blue_noise_mask() : rank(CELLS) {
+        const float sigma = 1.9f;
+        std::vector<float> kernel(CELLS);
+        for (int y = 0; y < BLUE_NOISE_SIZE; y++) {
+            for (int x = 0; x < BLUE_NOISE_SIZE; x++) {
+                int dx = std::min(x, BLUE_NOISE_SIZE - x), dy = std::min(y, BLUE_NOISE_SIZE - y);
+                kernel[y * BLUE_NOISE_SIZE + x] = std::exp(-(dx * dx + dy * dy) / (2 * sigma * sigma));
+            }
+        }
+
+        // Initial pattern: a tenth of the cells on at random, then the tightest cluster
+        // is moved to the largest void until that no longer changes anything
+        std::vector<bool> on(CELLS, false);
+        std::vector<float> energy(CELLS, 0);
+        simd::uint1 seed = 1;
+        int ones = CELLS / 10;
+        for (int placed = 0; placed < ones; ) {
+            int cell = pcg_hash(seed++) % CELLS;
+            if (!on[cell]) {
+                toggle(on, energy, kernel, cell);
+                placed++;
+            }
+        }
+        while (true) {
+            int cluster = extreme(on, energy, true);
+            toggle(on, energy, kernel, cluster);
+            int void_cell = extreme(on, energy, false);
+            toggle(on, energy, kernel, void_cell);
+            if (void_cell == cluster)
+                break;
+        }
+
+        // Rank the initial points by removing the tightest cluster first...
+        std::vector<bool> pattern = on;
+        std::vector<float> pattern_energy = energy;
+        for (int r = ones - 1; r >= 0; r--) {
+            int cluster = extreme(pattern, pattern_energy, true);
+            toggle(pattern, pattern_energy, kernel, cluster);
+            rank[cluster] = (r + 0.5f) / CELLS;
+        }
+
+        // ...then fill the largest void until every cell is ranked
+        for (int r = ones; r < CELLS; r++) {
+            int void_cell = extreme(on, energy, false);
+            toggle(on, energy, kernel, void_cell);
+            rank[void_cell] = (r + 0.5f) / CELLS;
+        }
+    }
+
+    float at(simd::uint1 x, simd::uint1 y) const {
+        return rank[(y % BLUE_NOISE_SIZE) * BLUE_NOISE_SIZE + x % BLUE_NOISE_SIZE];
+    }
+
+private:
+    static const int CELLS = BLUE_NOISE_SIZE * BLUE_NOISE_SIZE;
+
+    static void toggle(std::vector<bool> &on, std::vector<float> &energy, const std::vector<float> &kernel, int cell) {
+        on[cell] = !on[cell];
+        float sign = on[cell] ? 1 : -1;
+        int cx = cell % BLUE_NOISE_SIZE, cy = cell / BLUE_NOISE_SIZE;
+        for (int y = 0; y < BLUE_NOISE_SIZE; y++) {
+            int ky = (y - cy + BLUE_NOISE_SIZE) % BLUE_NOISE_SIZE;
+            for (int x = 0; x < BLUE_NOISE_SIZE; x++) {
+                int kx = (x - cx + BLUE_NOISE_SIZE) % BLUE_NOISE_SIZE;
+                energy[y * BLUE_NOISE_SIZE + x] += sign * kernel[ky * BLUE_NOISE_SIZE + kx];
+            }
+        }
+    }
+
+    // The on cell with the most energy (the tightest cluster) or the off cell with
+    // the least (the largest void)
+    static int extreme(const std::vector<bool> &on, const std::vector<float> &energy, bool cluster) {
+        int best = -1;
+        for (int cell = 0; cell < CELLS; cell++) {
+            if (on[cell] != cluster)
+                continue;
+            if (best < 0 || (cluster ? energy[cell] > energy[best] : energy[cell] < energy[best]))
+                best = cell;
+        }
+        return best;
+    }
+
+    std::vector<float> rank;
+};
+
+inline const blue_noise_mask &blue_noise() {
+    static const blue_noise_mask mask;
+    return mask;
+}
+
+// Builds whatever tables `type` reads, so the first frame's render tasks don't
+// stall on the mask's static guard while one of them builds it
+inline void prepare_sampler(sampler_type type) {
+    if (type == sampler_type::blue_noise)
+        blue_noise();
+}
+
+inline void blue_noise_2d(const pixel_sample &sample, simd::uint1 dim, float &u, float &v) {
+    // 1 / g and 1 / g^2 for the plastic number g, in 32-bit fixed point so the steps
+    // wrap modulo 1 exactly however many samples accumulate
+    const simd::uint1 r2_u = 3242174889u, r2_v = 2447445414u;
+    simd::uint1 offset_u = pcg_hash(dim * 2), offset_v = pcg_hash(dim * 2 + 1);
+    u = blue_noise().at(sample.x + offset_u, sample.y + (offset_u >> 16)) + to_unit_float(sample.index * r2_u);
+    v = blue_noise().at(sample.x + offset_v, sample.y + (offset_v >> 16)) + to_unit_float(sample.index * r2_v);
+    u = std::min(u - std::floor(u), 0x1.fffffep-1f);
+    v = std::min(v - std::floor(v), 0x1.fffffep-1f);
+}
+
+// -------------------------------------------------------------------------------
+// The two coordinates of dimension pair `dim` of a sample, in [0, 1). Pair 0 is the
+// pixel jitter; bounce d takes its direction from pair 2d - 1 and its roulette
+// number from pair 2d.
+inline void sample_2d(const pixel_sample &sample, simd::uint1 dim, float &u, float &v) {
+    switch (sample.type) {
+        case sampler_type::sobol: sobol_2d(sample, dim, u, v); break;
+        case sampler_type::lattice: lattice_2d(sample, dim, u, v); break;
+        case sampler_type::blue_noise: blue_noise_2d(sample, dim, u, v); break;
+        default: {
+            simd::uint1 seed = pcg_bounce_seed(pcg_path_seed(sample.pixel, 0, sample.index), dim);
+            u = pcg_random_float(seed);
+            v = pcg_random_float(seed);
+        }
+    }
+}
@@ -5,16 +5,17 @@
 
 class sphere : public hittable {
 public:
-    sphere(const point3& center, float radius, shared_ptr<material> mat)
-      : center(center), radius(fmax(0,radius)), mat(mat) {}
+    sphere(const point3& center, float radius, uint32_t mat_id)
+      : center(center), radius(fmax(0,radius)), mat_id(mat_id) {}
 
     virtual bool hit(
         const ray& r, simd::float1 t_min, simd::float1 t_max, hit_record& rec) const override;
+    virtual bool bounding_box(aabb& output_box) const override;
 
 public:
     point3 center;
     float radius;
-    shared_ptr<material> mat;
+    uint32_t mat_id;
 };
 
 bool sphere::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
@@ -37,9 +38,15 @@ bool sphere::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
 
     rec.t = root;
     rec.p = r.at(rec.t);
-    rec.mat = mat;
+    rec.mat_id = mat_id;
     vec3 outward_normal = (rec.p - center) / radius;
     rec.set_face_normal(r, outward_normal);
 
     return true;
 }
+
+bool sphere::bounding_box(aabb& output_box) const {
+    vec3 extent = simd::make_float3(radius, radius, radius);
+    output_box = aabb(center - extent, center + extent);
+    return true;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "hittable.h"
+#include "sphere.h"
+#include "dispatch.h"
+
+#include <vector>
+
+// Spheres packed as parallel arrays so one ray is tested against a whole SIMD
+// register of them at a time, without a pointer chase or virtual call per sphere.
+// The intersection kernel is picked at runtime for the CPU, see dispatch.h.
+class sphere_soa : public hittable {
+public:
+    sphere_soa() {}
+
+    void add(const point3& center, simd::float1 radius, uint32_t mat_id);
+    void add(const sphere& s) { add(s.center, s.radius, s.mat_id); }
+    void set(size_t i, const sphere& s);
+    size_t size() const { return radius.size(); }
+    sphere_span span() const { return span(0, size()); }
+    sphere_span span(size_t first, size_t count) const {
+        return sphere_span {
+            center_x.data() + first, center_y.data() + first, center_z.data() + first, radius.data() + first, count
+        };
+    }
+
+    virtual bool hit(
+        const ray& r, simd::float1 t_min, simd::float1 t_max, hit_record& rec) const override;
+    virtual bool bounding_box(aabb& output_box) const override;
+
+public:
+    std::vector<float> center_x;
+    std::vector<float> center_y;
+    std::vector<float> center_z;
+    std::vector<float> radius;
+    std::vector<uint32_t> mat_id;
+};
+
+void sphere_soa::add(const point3& center, simd::float1 r, uint32_t id) {
+    center_x.push_back(center.x);
+    center_y.push_back(center.y);
+    center_z.push_back(center.z);
+    radius.push_back(fmax(0, r));
+    mat_id.push_back(id);
+}
+
+void sphere_soa::set(size_t i, const sphere& s) {
+    center_x[i] = s.center.x;
+    center_y[i] = s.center.y;
+    center_z[i] = s.center.z;
+    radius[i] = fmax(0, s.radius);
+    mat_id[i] = s.mat_id;
+}
+
+bool sphere_soa::hit(const ray& r, simd::float1 t_min, simd::float1 t_max, hit_record& rec) const {
+    int i = kernels().sphere_closest_hit(span(), r, t_min, t_max);
+    if (i < 0)
+        return false;
+
+    point3 center = simd::make_float3(center_x[i], center_y[i], center_z[i]);
+    rec.t = t_max;
+    rec.p = r.at(rec.t);
+    rec.mat_id = mat_id[i];
+    vec3 outward_normal = (rec.p - center) / radius[i];
+    rec.set_face_normal(r, outward_normal);
+
+    return true;
+}
+
+bool sphere_soa::bounding_box(aabb& output_box) const {
+    if (size() == 0)
+        return false;
+
+    output_box = aabb();
+    for (size_t i = 0; i < size(); i++) {
+        point3 center = simd::make_float3(center_x[i], center_y[i], center_z[i]);
+        vec3 extent = simd::make_float3(radius[i], radius[i], radius[i]);
+        output_box.expand(aabb(center - extent, center + extent));
+    }
+    return true;
+}
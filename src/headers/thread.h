@@ -1,12 +1,17 @@
 #pragma once
 
-#include <mutex>
-#include <queue>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
 #include <condition_variable>
+#include <cstdint>
 #include <functional>
+#include <memory>
+#include <mutex>
 #include <thread>
 #include <utility>
-#include <simd/simd.h>
+#include <vector>
+#include <sys/types.h>
 
 struct RenderTask {
     uint start_x, start_y;
@@ -15,97 +20,178 @@ struct RenderTask {
     bool is_shutdown = 0;
 };
 
-template<typename T>
-class ThreadQueue {
-private:
-    std::queue<T> queue;
-    mutable std::mutex mutex;
-    std::condition_variable cv;
-
+// Chase-Lev work-stealing deque of task indices. Only the owning worker pushes and
+// takes, at the bottom; any other worker may steal from the top. The ring never
+// grows, so it has to be created with room for every task pushed in one frame.
+class TaskDeque {
 public:
+    static const int32_t EMPTY = -1;
+
+    TaskDeque(size_t capacity) {
+        size_t size = 1;
+        while (size < capacity)
+            size <<= 1;
+        mask = size - 1;
+        slots = std::make_unique<std::atomic<int32_t>[]>(size);
+    }
 
-    ThreadQueue() {}
-
-    void push(T &value) {
-        std::unique_lock<std::mutex> lock(mutex);
-        queue.push(std::move(value)); 
-        lock.unlock();
-        cv.notify_one();
+    void push(int32_t task) {
+        int64_t b = bottom.load(std::memory_order_relaxed);
+        slots[b & mask].store(task, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom.store(b + 1, std::memory_order_relaxed);
     }
 
-    bool try_pop(T &value) {
-        std::lock_guard<std::mutex> lock(mutex);
-        if (queue.empty()) {
-            return false;
+    int32_t take() {
+        int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top.load(std::memory_order_relaxed);
+
+        if (t > b) {
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return EMPTY;
         }
-        value = std::move(queue.front());
-        queue.pop();
-        return true;
-    }
 
-    void wait_and_pop(T& value) {
-        std::unique_lock<std::mutex> lock(mutex);
-        cv.wait(lock, [this]{ return !queue.empty(); });
-        value = std::move(queue.front());
-        queue.pop();
+        int32_t task = slots[b & mask].load(std::memory_order_relaxed);
+        if (t == b) {
+            // Last task left: race the thieves for it
+            if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                task = EMPTY;
+            bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return task;
     }
 
-    void wait_until(std::function<bool()> func) {
-        std::unique_lock<std::mutex> lock(mutex);
-        cv.wait(lock);
-    }
+    int32_t steal() {
+        int64_t t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom.load(std::memory_order_acquire);
 
-    bool empty() {
-        std::lock_guard<std::mutex> lock(mutex);
-        return queue.empty();
-    }
+        if (t >= b)
+            return EMPTY;
 
-    int size() {
-        std::lock_guard<std::mutex> lock(mutex);
-        return queue.size();
+        int32_t task = slots[t & mask].load(std::memory_order_relaxed);
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            return EMPTY;
+        return task;
     }
 
+private:
+    alignas(64) std::atomic<int64_t> top{0};
+    alignas(64) std::atomic<int64_t> bottom{0};
+    std::unique_ptr<std::atomic<int32_t>[]> slots;
+    size_t mask;
 };
 
+// Renders each frame's tiles on a fixed pool of workers. Every worker starts the
+// frame with an even share of the tiles in its own deque and, once that runs dry,
+// steals from the others. Finished tiles count down an atomic latch that
+// wait_for_completion spins on, so no lock is taken per tile.
 struct ThreadManager {
-    ThreadQueue<RenderTask> task_queue;
-    ThreadQueue<RenderTask> completion_queue;
     std::vector<std::thread> thread_pool;
+    std::vector<std::unique_ptr<TaskDeque>> deques;
     std::vector<RenderTask> task_collection;
     int thread_count;
 
-    ThreadManager(uint tex_width, uint tex_height)
-        : thread_count(std::thread::hardware_concurrency()) 
+    std::function<void(const RenderTask&)> render_task;
+
+    std::mutex frame_mutex;
+    std::condition_variable frame_cv;
+    std::atomic<uint64_t> frame{0};
+    std::atomic<int> remaining{0};
+    std::atomic<uint64_t> steals{0};
+    bool shutting_down = false;
+
+    // Tiles are always cut for the machine's core count, so the same frame is
+    // split the same way however many workers there are
+    ThreadManager(uint tex_width, uint tex_height, int workers = std::thread::hardware_concurrency())
+        : thread_count(std::max(workers, 1))
     {
-        task_collection = generate_tasks(tex_width, tex_height, thread_count);
+        task_collection = generate_tasks(tex_width, tex_height, std::max(std::thread::hardware_concurrency(), 1u));
+        for (int i = 0; i < thread_count; i++)
+            deques.push_back(std::make_unique<TaskDeque>(task_collection.size()));
     }
 
+    ~ThreadManager() {
+        {
+            std::lock_guard<std::mutex> lock(frame_mutex);
+            shutting_down = true;
+            frame++;
+        }
+        frame_cv.notify_all();
+        for (auto &thread : thread_pool)
+            thread.join();
+    }
 
+    // `f` is called as f(task, args...) for every tile of every frame
     template<typename Func, typename... Args>
     void threads_init(Func f, Args&&... args) {
+        render_task = [=](const RenderTask &task) { f(task, args...); };
         for (int i = 0; i < thread_count; i++) {
-            thread_pool.emplace_back(f, std::forward<Args>(args)...);
+            thread_pool.emplace_back(&ThreadManager::worker, this, i);
         }
     }
 
     void push_tasks() {
-        for (auto &task : task_collection) {
-            task_queue.push(task);
+        {
+            std::lock_guard<std::mutex> lock(frame_mutex);
+            remaining.store(task_collection.size(), std::memory_order_relaxed);
+            steals.store(0, std::memory_order_relaxed);
+            frame++;
         }
+        frame_cv.notify_all();
     }
 
     void wait_for_completion() {
-        int completed = 0;
-        while (completed < task_collection.size()) {
-            RenderTask task;
-            completion_queue.wait_and_pop(task);
-            completed++;
+        while (remaining.load(std::memory_order_acquire) > 0)
+            std::this_thread::yield();
+    }
+
+    void worker(int id) {
+        uint64_t seen = 0;
+        TaskDeque &own = *deques[id];
+
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(frame_mutex);
+                frame_cv.wait(lock, [&]{ return frame.load() != seen; });
+                if (shutting_down)
+                    return;
+                seen = frame.load();
+            }
+
+            // Pushed back to front so the owner works through its share in order
+            // while thieves take from the far end
+            size_t count = task_collection.size();
+            size_t first = count * id / thread_count;
+            size_t last = count * (id + 1) / thread_count;
+            for (size_t i = last; i > first; i--)
+                own.push(i - 1);
+
+            // Keep stealing until every tile is done, not just until the deques look
+            // empty, since a slow worker may not have filled its own yet
+            while (frame.load() == seen && remaining.load(std::memory_order_acquire) > 0) {
+                int32_t task = own.take();
+                for (int n = 1; task == TaskDeque::EMPTY && n < thread_count; n++) {
+                    task = deques[(id + n) % thread_count]->steal();
+                    if (task != TaskDeque::EMPTY)
+                        steals.fetch_add(1, std::memory_order_relaxed);
+                }
+
+                if (task == TaskDeque::EMPTY) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                render_task(task_collection[task]);
+                remaining.fetch_sub(1, std::memory_order_acq_rel);
+            }
         }
     }
 
     std::vector<RenderTask> generate_tasks(uint tex_width, uint tex_height, uint threads) {
         std::vector<RenderTask> tasks;
-    
+
         int num_tiles_x = std::sqrt(threads);
         int num_tiles_y = threads / num_tiles_x;
         while (num_tiles_x * num_tiles_y != threads) {
@@ -113,8 +199,9 @@ struct ThreadManager {
             num_tiles_y = threads / num_tiles_x;
         }
 
-        int stride_i = tex_width / num_tiles_x / 16;
-        int stride_j = tex_height / num_tiles_y / 16;
+        // Frames smaller than the tile grid still get tiles of at least a pixel
+        int stride_i = std::max(1, (int)tex_width / num_tiles_x / 16);
+        int stride_j = std::max(1, (int)tex_height / num_tiles_y / 16);
 
         for (uint j = 0; j < tex_height; j += stride_j) {
             for (uint i = 0; i < tex_width; i += stride_i) {
@@ -132,4 +219,3 @@ struct ThreadManager {
         return tasks;
     }
 };
-
@@ -0,0 +1,351 @@
+#pragma once
+
+#include "util.h"
+#include "parameters.h"
+#include "thread.h"
+#include "hittable_list.h"
+#include "camera.h"
+#include "material.h"
+#include "wavefront.h"
+#include "dispatch.h"
+#include "sampler.h"
+
+#include <algorithm>
+#include <chrono>
+
+// The integrators behind each render mode. Each one renders the pixels of a
+// RenderTask into parameters.color_buffer and adds its ray counts to parameters.ray_stats.
+// resolve_tile then turns the rendered pixels into the displayed ones.
+
+// --------------------------------------PCG-------------------------------------
+color sky_color(const ray& r) {
+    vec3 unit_direction = simd::normalize(r.direction());
+    auto t = 0.5*(unit_direction.y + 1.0);
+    return (1.0-t)*simd::make_float3(1.0, 1.0, 1.0) + t*simd::make_float3(0.5, 0.7, 1.0);
+}
+
+// Past rr_depth bounces a path survives with probability equal to its brightest
+// throughput channel, and survivors are scaled up to keep the estimate unbiased
+bool russian_roulette(color& throughput, simd::float1 xi) {
+    simd::float1 p = std::min(0.95f, simd::reduce_max(throughput));
+    if (xi >= p)
+        return false;
+    throughput /= p;
+    return true;
+}
+
+// Bounce `depth` of a path, with the point the sampler gives for it
+bool sampled_scatter(const material *mat, const ray& r, const hit_record& rec, color& attenuation, ray& scattered,
+                     const pixel_sample& sample, int depth) {
+    float u, v;
+    sample_2d(sample, 2 * depth - 1, u, v);
+    return mat->scatter(r, rec, attenuation, scattered, u, v);
+}
+
+simd::float1 sampled_roulette(const pixel_sample& sample, int depth) {
+    float xi, unused;
+    sample_2d(sample, 2 * depth, xi, unused);
+    return xi;
+}
+
+// Color seen along a camera ray whose closest hit is already known. The path is
+// followed bounce by bounce, carrying the product of the attenuations so far. Each
+// bounce scatters and plays roulette with numbers from its own stream of path_seed,
+// or from `sample` when a low-discrepancy sampler is in use.
+color pcg_ray_color(ray r, bool hit, hit_record rec, const Scene& scene, const Parameters& params, simd::uint1 path_seed,
+                    const pixel_sample *sample, uint64_t& rays) {
+    color throughput = simd::make_float3(1, 1, 1);
+
+    for (int depth = 1; ; depth++) {
+        if (!hit)
+            return throughput * sky_color(r);
+
+        ray scattered;
+        color attenuation;
+        const material *mat = scene.get_material(rec.mat_id);
+        simd::uint1 seed = pcg_bounce_seed(path_seed, depth);
+        if (depth >= params.max_depth)
+            return simd::make_float3(0, 0, 0);
+        if (!(sample ? sampled_scatter(mat, r, rec, attenuation, scattered, *sample, depth)
+                     : mat->scatter(r, rec, attenuation, scattered, seed)))
+            return simd::make_float3(0, 0, 0);
+        throughput *= attenuation;
+
+        if (depth >= params.rr_depth &&
+            !russian_roulette(throughput, sample ? sampled_roulette(*sample, depth) : pcg_random_float(seed)))
+            return simd::make_float3(0, 0, 0);
+
+        r = scattered;
+        rays++;
+        hit = scene.world.hit(r, 0.001, infinity, rec);
+    }
+}
+
+// Walks the task in PACKET_DIM x PACKET_DIM pixel blocks. Each sample first traces the
+// block's camera rays, as one packet or one at a time, then follows every bounce with
+// single rays since those head off in unrelated directions.
+void pcg_render(Scene& scene, camera& cam, Parameters &parameters, RenderTask task) {
+    // Each accumulated frame traces new, independent paths, or continues the sampler's sequence
+    const simd::uint1 frame = parameters.accumulated_frames;
+    const sampler_type sampler = parameters.sampler;
+    uint64_t primary_rays = 0, secondary_rays = 0;
+    double primary_time = 0, secondary_time = 0;
+
+    for (int by = task.start_y; by < task.end_y; by += PACKET_DIM) {
+        for (int bx = task.start_x; bx < task.end_x; bx += PACKET_DIM) {
+            simd::uint1 pixel_index[PACKET_SIZE];
+            color pixel_color[PACKET_SIZE];
+            uint32_t active = 0;
+
+            for (int k = 0; k < PACKET_SIZE; k++) {
+                int i = bx + k % PACKET_DIM;
+                int j = by + k / PACKET_DIM;
+                pixel_index[k] = j * parameters.tex_width + i;
+                if (i >= task.end_x || j >= task.end_y)
+                    continue;
+                active |= 1u << k;
+                pixel_color[k] = simd::make_float3(0, 0, 0);
+            }
+
+            for (int s = 0; s < parameters.samples_per_pixel; ++s) {
+                simd::uint1 path_seed[PACKET_SIZE], jitter_seed[PACKET_SIZE];
+                for (int k = 0; k < PACKET_SIZE; k++) {
+                    path_seed[k] = pcg_path_seed(pixel_index[k], frame, s);
+                    jitter_seed[k] = pcg_bounce_seed(path_seed[k], 0);
+                }
+
+                // The whole packet's jitter in two vector draws, u before v for every pixel
+                float u[PACKET_SIZE], v[PACKET_SIZE];
+                pixel_sample samples[PACKET_SIZE];
+                if (sampler == sampler_type::white) {
+                    kernels().random_floats(jitter_seed, u, PACKET_SIZE);
+                    kernels().random_floats(jitter_seed, v, PACKET_SIZE);
+                } else {
+                    for (int k = 0; k < PACKET_SIZE; k++) {
+                        samples[k] = pixel_sample {
+                            .type = sampler,
+                            .x = (simd::uint1)(bx + k % PACKET_DIM),
+                            .y = (simd::uint1)(by + k / PACKET_DIM),
+                            .pixel = pixel_index[k],
+                            .index = (simd::uint1)(parameters.accumulated_samples + s),
+                        };
+                        sample_2d(samples[k], 0, u[k], v[k]);
+                    }
+                }
+                for (int k = 0; k < PACKET_SIZE; k++) {
+                    u[k] = (bx + k % PACKET_DIM + u[k]) / (parameters.tex_width-1);
+                    v[k] = (by + k / PACKET_DIM + v[k]) / (parameters.tex_height-1);
+                }
+
+                auto primary_start = NOW();
+                ray_packet packet;
+                hit_record recs[PACKET_SIZE];
+                cam.get_packet(u, v, active, packet);
+
+                uint32_t hits = 0;
+                if (parameters.packet_primary) {
+                    hits = scene.world.hit_packet(packet, 0.001, recs);
+                } else {
+                    for (int k = 0; k < PACKET_SIZE; k++) {
+                        if ((active & (1u << k)) && scene.world.hit(packet.rays[k], 0.001, infinity, recs[k]))
+                            hits |= 1u << k;
+                    }
+                }
+                primary_rays += __builtin_popcount(active);
+
+                auto secondary_start = NOW();
+                primary_time += GET_TIME(secondary_start, primary_start);
+
+                for (int k = 0; k < PACKET_SIZE; k++) {
+                    if (!(active & (1u << k)))
+                        continue;
+                    pixel_color[k] += pcg_ray_color(
+                        packet.rays[k], hits & (1u << k), recs[k], scene, parameters, path_seed[k],
+                        sampler == sampler_type::white ? nullptr : &samples[k], secondary_rays);
+                }
+                secondary_time += GET_TIME(NOW(), secondary_start);
+            }
+
+            for (int k = 0; k < PACKET_SIZE; k++) {
+                if (active & (1u << k))
+                    parameters.color_buffer[(by + k / PACKET_DIM) * parameters.tex_width + bx + k % PACKET_DIM] = pixel_color[k];
+            }
+        }
+    }
+
+    parameters.ray_stats.primary_rays += primary_rays;
+    parameters.ray_stats.secondary_rays += secondary_rays;
+    parameters.ray_stats.primary_ns += static_cast<uint64_t>(primary_time * 1e9);
+    parameters.ray_stats.secondary_ns += static_cast<uint64_t>(secondary_time * 1e9);
+}
+// ----------------------------------WAVEFRONT-----------------------------------
+// Same paths as pcg_render, but traced one bounce at a time for the whole task:
+// intersect every queued ray, bucket the hits by material, shade each bucket in
+// one batch and compact the surviving paths into the queue for the next bounce.
+void wavefront_render(Scene& scene, camera& cam, Parameters &parameters, RenderTask task) {
+    const simd::uint1 frame = parameters.accumulated_frames;
+    static thread_local WavefrontQueues queues;
+
+    queues.paths.clear();
+    for (int j = task.start_y; j < task.end_y; j++) {
+        for (int i = task.start_x; i < task.end_x; i++) {
+            uint32_t pixel = j * parameters.tex_width + i;
+            parameters.color_buffer[pixel] = simd::make_float3(0, 0, 0);
+
+            for (int s = 0; s < parameters.samples_per_pixel; ++s) {
+                simd::uint1 path_seed = pcg_path_seed(pixel, frame, s);
+                simd::uint1 jitter_seed = pcg_bounce_seed(path_seed, 0);
+                auto u = (i + pcg_random_float(jitter_seed)) / (parameters.tex_width-1);
+                auto v = (j + pcg_random_float(jitter_seed)) / (parameters.tex_height-1);
+                queues.paths.push_back(path_state {
+                    .r = cam.get_ray(u, v),
+                    .throughput = simd::make_float3(1, 1, 1),
+                    .pixel = pixel,
+                    .path_seed = path_seed,
+                });
+            }
+        }
+    }
+
+    uint64_t primary_rays = queues.paths.size(), secondary_rays = 0;
+    double primary_time = 0, secondary_time = 0;
+
+    for (int depth = 0; depth < parameters.max_depth && !queues.paths.empty(); depth++) {
+        auto start = NOW();
+        uint32_t count = queues.paths.size();
+        if (queues.recs.size() < count)
+            queues.recs.resize(count);
+
+        // Misses pick up the sky and leave the queue; hits are compacted to the front
+        // and get the stream pcg_ray_color would use for this bounce
+        uint32_t hits = 0;
+        for (uint32_t n = 0; n < count; n++) {
+            const path_state &path = queues.paths[n];
+            if (scene.world.hit(path.r, 0.001, infinity, queues.recs[hits])) {
+                queues.paths[hits] = path;
+                queues.paths[hits++].seed = pcg_bounce_seed(path.path_seed, depth + 1);
+            } else {
+                parameters.color_buffer[path.pixel] += path.throughput * sky_color(path.r);
+            }
+        }
+
+        queues.sort_by_material(hits, scene.material_table);
+        queues.next_paths.clear();
+        kernels().shade_lambertian(queues, scene.material_table, queues.next_paths);
+        kernels().shade_metal(queues, scene.material_table, queues.next_paths);
+        std::swap(queues.paths, queues.next_paths);
+
+        // Same roulette, with the same random numbers, as pcg_ray_color
+        if (depth + 1 >= parameters.rr_depth) {
+            uint32_t survivors = 0;
+            for (path_state &path : queues.paths) {
+                if (russian_roulette(path.throughput, pcg_random_float(path.seed)))
+                    queues.paths[survivors++] = path;
+            }
+            queues.paths.resize(survivors);
+        }
+
+        if (depth == 0) {
+            primary_time += GET_TIME(NOW(), start);
+        } else {
+            secondary_rays += count;
+            secondary_time += GET_TIME(NOW(), start);
+        }
+    }
+
+    parameters.ray_stats.primary_rays += primary_rays;
+    parameters.ray_stats.secondary_rays += secondary_rays;
+    parameters.ray_stats.primary_ns += static_cast<uint64_t>(primary_time * 1e9);
+    parameters.ray_stats.secondary_ns += static_cast<uint64_t>(secondary_time * 1e9);
+}
+// -----------------------------------------------------------------------------
+color ray_color(ray r, const Scene& scene, const Parameters& params, pcg32& rng, const pixel_sample *sample, uint64_t& rays) {
+    color throughput = simd::make_float3(1, 1, 1);
+    hit_record rec;
+
+    for (int depth = 1; ; depth++) {
+        rays++;
+        if (!scene.world.hit(r, 0.001, infinity, rec))
+            return throughput * sky_color(r);
+
+        ray scattered;
+        color attenuation;
+        const material *mat = scene.get_material(rec.mat_id);
+        if (depth >= params.max_depth)
+            return simd::make_float3(0, 0, 0);
+        if (!(sample ? sampled_scatter(mat, r, rec, attenuation, scattered, *sample, depth)
+                     : mat->scatter(r, rec, attenuation, scattered, rng)))
+            return simd::make_float3(0, 0, 0);
+        throughput *= attenuation;
+
+        if (depth >= params.rr_depth &&
+            !russian_roulette(throughput, sample ? sampled_roulette(*sample, depth) : random_float(rng)))
+            return simd::make_float3(0, 0, 0);
+        r = scattered;
+    }
+}
+
+// Every pixel draws from its own pcg32 stream, seeded with the frame number, so the
+// image only depends on the frame and not on how the tiles were spread over threads
+void render(Scene& scene, camera& cam, Parameters& parameters, RenderTask task) {
+    uint64_t rays = 0;
+
+    for (int j = task.start_y; j < task.end_y; j++) {
+        for (int i = task.start_x; i < task.end_x; i++) {
+            pcg32 rng(parameters.accumulated_frames, j * parameters.tex_width + i);
+            color pixel_color = simd::make_float3(0, 0, 0);;
+            for (int s = 0; s < parameters.samples_per_pixel; ++s) {
+                pixel_sample sample {
+                    .type = parameters.sampler,
+                    .x = (simd::uint1)i,
+                    .y = (simd::uint1)j,
+                    .pixel = (simd::uint1)(j * parameters.tex_width + i),
+                    .index = (simd::uint1)(parameters.accumulated_samples + s),
+                };
+                bool white = sample.type == sampler_type::white;
+
+                float du, dv;
+                if (white) {
+                    du = random_float(rng);
+                    dv = random_float(rng);
+                } else {
+                    sample_2d(sample, 0, du, dv);
+                }
+                auto u = (i + du) / (parameters.tex_width-1);
+                auto v = (j + dv) / (parameters.tex_height-1);
+                ray r = cam.get_ray(u, v);
+                pixel_color += ray_color(r, scene, parameters, rng, white ? nullptr : &sample, rays);
+            }
+            parameters.color_buffer[j * parameters.tex_width + i] = pixel_color;
+        }
+    }
+
+    uint64_t paths = (task.end_x - task.start_x) * (task.end_y - task.start_y) * parameters.samples_per_pixel;
+    parameters.ray_stats.primary_rays += paths;
+    parameters.ray_stats.secondary_rays += rays - paths;
+}
+
+// --------------------------------------Resolve---------------------------------
+// Adds a rendered tile of color_buffer to the running sum in accum_buffer and packs
+// it into pack_target, one row at a time so each row is packed while it is still in
+// this core's cache. Called by whichever thread rendered the tile.
+void resolve_tile(Parameters &parameters, const RenderTask &task) {
+    int tile_width = task.end_x - task.start_x;
+    bool first = parameters.accumulated_frames == 0;
+    int samples = parameters.accumulated_samples + parameters.samples_per_pixel;
+
+    for (uint y = task.start_y; y < task.end_y; y++) {
+        const color *frame = parameters.color_buffer + y * parameters.tex_width + task.start_x;
+        color *accum = parameters.accum_buffer + y * parameters.tex_width + task.start_x;
+
+        if (first) {
+            std::copy(frame, frame + tile_width, accum);
+        } else {
+            for (int i = 0; i < tile_width; i++)
+                accum[i] += frame[i];
+        }
+
+        uint *packed = parameters.pack_target + y * parameters.pack_pitch + task.start_x;
+        kernels().color_pack(accum, packed, samples, tile_width, parameters.stream_pack);
+    }
+}
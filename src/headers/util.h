@@ -1,6 +1,8 @@
 #pragma once
 
-#include <simd/simd.h>
+#include "vecmath.h"
+#include <cstdint>
+#include <limits>
 #include <memory>
 #include <sys/types.h>
 
@@ -21,25 +23,69 @@ inline simd::float1 degrees_to_radians(simd::float1 degrees) {
     return degrees * pi/180.0;
 }
 
-inline simd::float1 random_float() {
-    return rand() / (RAND_MAX + 1.0);
+// PCG32 (XSH-RR). Every odd increment selects an independent stream, so each
+// pixel can draw from its own generator whatever thread renders it.
+struct pcg32 {
+    uint64_t state = 0;
+    uint64_t inc;
+
+    pcg32(uint64_t seed, uint64_t stream) : inc((stream << 1) | 1) {
+        next();
+        state += seed;
+        next();
+    }
+
+    uint32_t next() {
+        uint64_t old = state;
+        state = old * 6364136223846793005ULL + inc;
+        uint32_t xorshifted = ((old >> 18) ^ old) >> 27;
+        uint32_t rot = old >> 59;
+        return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+    }
+};
+
+// Uniform in [0, 1), from the top 24 bits so it never rounds up to 1
+inline simd::float1 random_float(pcg32 &rng) {
+    return (rng.next() >> 8) * 0x1p-24f;
 }
 
-inline simd::float1 random_float(simd::float1 min, simd::float1 max) {
-    return min + (max-min)*random_float();
+inline simd::float1 random_float(pcg32 &rng, simd::float1 min, simd::float1 max) {
+    return min + (max-min)*random_float(rng);
 }
 
 inline simd::float1 pcg_random_float(simd::uint1& seed) {
     seed = seed * 747796405 + 2891336453;
     simd::uint1 result = ((seed >> ((seed >> 28) + 4)) ^ seed) * 277803737;
 	result = (result >> 22) ^ result;
-    return result / 4294967295.0;
+
+    // Top 24 bits, so the value is exact, below 1 and matches the pcg_lanes kernels
+    return (result >> 8) * 0x1p-24f;
 }
 
 inline simd::float1 pcg_random_float(simd::uint1 seed, simd::float1 min, simd::float1 max) {
     return min + (max-min)*pcg_random_float(seed);
 }
 
+// PCG's RXS-M-XS output function used as an integer hash: nearby inputs give
+// unrelated outputs
+inline simd::uint1 pcg_hash(simd::uint1 x) {
+    simd::uint1 state = x * 747796405u + 2891336453u;
+    simd::uint1 word = ((state >> ((state >> 28) + 4)) ^ state) * 277803737u;
+    return (word >> 22) ^ word;
+}
+
+// Seeds for the PCG renderers. Every sample of every pixel in every frame starts an
+// independent path, and every bounce of that path draws from its own stream, bounce
+// 0 being the camera ray's jitter. The same inputs always give the same seeds, so a
+// frame is reproducible from its number alone.
+inline simd::uint1 pcg_path_seed(simd::uint1 pixel, simd::uint1 frame, simd::uint1 sample) {
+    return pcg_hash(pcg_hash(pcg_hash(pixel) ^ frame) ^ sample);
+}
+
+inline simd::uint1 pcg_bounce_seed(simd::uint1 path_seed, simd::uint1 depth) {
+    return pcg_hash(path_seed ^ depth);
+}
+
 #define NOW() (std::chrono::high_resolution_clock::now())
 #define GET_TIME(_c, _l) (std::chrono::duration_cast<std::chrono::duration<float>>(_c - _l).count())
 
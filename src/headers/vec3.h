@@ -1,7 +1,8 @@
 #pragma once
 
 #include "util.h"
-#include <simd/simd.h>
+#include "vecmath.h"
+#include <algorithm>
 #include <cmath>
 
 using std::sqrt;
@@ -12,52 +13,84 @@ using point3 = simd::float3;  // 3D point
 using color = simd::float3;   // RGB color
 using vec3 = simd::float3;    // 3D vector
 
-inline static simd::float3 random3() {
-    return simd::make_float3(random_float(), random_float(), random_float());
+inline static simd::float3 random3(pcg32 &rng) {
+    return simd::make_float3(random_float(rng), random_float(rng), random_float(rng));
 }
 
 inline static simd::float3 pcg_random3(simd::uint1 &seed) {
     return simd::make_float3(pcg_random_float(seed), pcg_random_float(seed), pcg_random_float(seed));
 }
 
-inline static simd::float3 random3(simd::double1 min, simd::double1 max) {
-    return simd::make_float3(random_float(min, max), random_float(min, max), random_float(min, max));
+inline static simd::float3 random3(pcg32 &rng, simd::double1 min, simd::double1 max) {
+    return simd::make_float3(random_float(rng, min, max), random_float(rng, min, max), random_float(rng, min, max));
 }
 
 inline static simd::float3 pcg_random3(simd::uint1 &seed, simd::double1 min, simd::double1 max) {
     return simd::make_float3(pcg_random_float(seed, min, max), pcg_random_float(seed, min, max), pcg_random_float(seed, min, max));
 }
 
-vec3 random_in_unit_sphere() {
-    while (true) {
-        auto p = random3(-1,1);
-        if (simd::length_squared(p) >= 1) continue;
-        return p;
-    }
+// sin and cos of 2 pi v for v in [0, 1) with no branches or table: Taylor
+// polynomials give the half angle pi (v - 1/2), which stays within [-pi/2, pi/2],
+// and the double angle formulas the rest. Good to within 1e-6.
+inline void sincos_2pi(float v, float &sin, float &cos) {
+    float x = static_cast<float>(pi) * (v - 0.5f), x2 = x * x;
+    float half_sin = x * (1 + x2 * (-1 / 6.0f + x2 * (1 / 120.0f + x2 * (-1 / 5040.0f
+                   + x2 * (1 / 362880.0f + x2 * (-1 / 39916800.0f))))));
+    float half_cos = 1 + x2 * (-1 / 2.0f + x2 * (1 / 24.0f + x2 * (-1 / 720.0f + x2 * (1 / 40320.0f
+                   + x2 * (-1 / 3628800.0f + x2 * (1 / 479001600.0f))))));
+    sin = -2 * half_sin * half_cos;
+    cos = 2 * half_sin * half_sin - 1;
 }
 
-vec3 pcg_in_unit_sphere(simd::uint1 &seed) {
-
-    for (int safetey_limit = 0; safetey_limit < 100; safetey_limit++) {
-        float x = pcg_random_float(seed) * 2 - 1;
-        float y = pcg_random_float(seed) * 2 - 1;
-        float z = pcg_random_float(seed) * 2 - 1;
-        vec3 p = simd::make_float3(x, y, z);
+// Uniform point on the unit sphere from a point of the unit square: z is uniform
+// in [-1, 1] and the angle around z uniform, which is uniform over the sphere
+inline vec3 unit_sphere_from_square(float u, float v) {
+    float z = 1 - 2 * u;
+    float r = std::sqrt(std::max(0.0f, 1 - z * z));
+    float sin, cos;
+    sincos_2pi(v, sin, cos);
+    return simd::make_float3(r * cos, r * sin, z);
+}
 
-        if (simd::length_squared(p) < 1) {
-            return p;
-        }
-    }
+// Cosine-weighted direction in the hemisphere around a unit normal: a uniform
+// point of the unit disk (Malley's method) lifted onto the hemisphere. This is
+// the distribution of normal + random unit vector, but never degenerate. The
+// tangents come from Duff et al., "Building an Orthonormal Basis, Revisited"
+// (JCGT 2017), which needs no branch on the normal.
+inline vec3 cosine_hemisphere_from_square(const vec3 &normal, float u, float v) {
+    float r = std::sqrt(u), z = std::sqrt(1 - u);
+    float sin, cos;
+    sincos_2pi(v, sin, cos);
 
-    return vec3();
+    float sign = normal.z < 0 ? -1.0f : 1.0f;
+    float a = -1 / (sign + normal.z);
+    float b = normal.x * normal.y * a;
+    vec3 tangent = simd::make_float3(1 + sign * normal.x * normal.x * a, sign * b, -sign * normal.x);
+    vec3 bitangent = simd::make_float3(b, sign + normal.y * normal.y * a, -normal.y);
+    return tangent * (r * cos) + bitangent * (r * sin) + normal * z;
 }
 
-vec3 random_unit_vector() {
-    return simd::normalize(random_in_unit_sphere());
+vec3 random_unit_vector(pcg32 &rng) {
+    float u = random_float(rng);
+    float v = random_float(rng);
+    return unit_sphere_from_square(u, v);
 }
 
 vec3 pcg_unit_vector(simd::uint1 &seed) {
-    return simd::normalize(pcg_in_unit_sphere(seed));
+    float u = pcg_random_float(seed);
+    float v = pcg_random_float(seed);
+    return unit_sphere_from_square(u, v);
+}
+
+// Uniform in the ball: a unit vector scaled by the cube root of a uniform number
+vec3 random_in_unit_sphere(pcg32 &rng) {
+    vec3 direction = random_unit_vector(rng);
+    return direction * std::cbrt(random_float(rng));
+}
+
+vec3 pcg_in_unit_sphere(simd::uint1 &seed) {
+    vec3 direction = pcg_unit_vector(seed);
+    return direction * std::cbrt(pcg_random_float(seed));
 }
 
 bool near_zero(simd::float3 &v) {
@@ -0,0 +1,216 @@
+#pragma once
+
+// The subset of Apple's <simd/simd.h> C++ API the tracer uses, so the same code
+// builds on macOS, ARM Linux and x86-64 Linux. A float3 is one 128-bit register
+// whose fourth lane is padding, as in Apple's layout, held in an SSE register on
+// x86-64 (SSE4.1 and up, so also every AVX2 and AVX-512 target), a NEON register
+// on ARM and four plain floats anywhere else. The wider AVX2 and AVX-512 registers
+// are used by the batched kernels in lanes.h, which process many rays or spheres
+// at once instead of the three components of one vector.
+
+#if defined(__SSE4_1__)
+#include <immintrin.h>
+#define VECMATH_BACKEND "sse4"
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define VECMATH_BACKEND "neon"
+#else
+#define VECMATH_BACKEND "scalar"
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <type_traits>
+
+namespace simd {
+
+using float1 = float;
+using double1 = double;
+using int1 = int;
+using uint1 = unsigned int;
+
+namespace detail {
+
+#if defined(__SSE4_1__)
+using f32x4 = __m128;
+
+inline f32x4 set(float x, float y, float z) { return _mm_setr_ps(x, y, z, 0); }
+inline f32x4 splat(float s) { return _mm_set1_ps(s); }
+
+inline f32x4 add(f32x4 a, f32x4 b) { return _mm_add_ps(a, b); }
+inline f32x4 sub(f32x4 a, f32x4 b) { return _mm_sub_ps(a, b); }
+inline f32x4 mul(f32x4 a, f32x4 b) { return _mm_mul_ps(a, b); }
+inline f32x4 div(f32x4 a, f32x4 b) { return _mm_div_ps(a, b); }
+inline f32x4 min(f32x4 a, f32x4 b) { return _mm_min_ps(a, b); }
+inline f32x4 max(f32x4 a, f32x4 b) { return _mm_max_ps(a, b); }
+inline f32x4 sqrt(f32x4 a) { return _mm_sqrt_ps(a); }
+inline f32x4 neg(f32x4 a) { return _mm_xor_ps(a, _mm_set1_ps(-0.0f)); }
+
+// x*x' + y*y' + z*z', summed as (x + y) + z. Two shuffles and adds beat the
+// long latency of _mm_dp_ps.
+inline float dot3(f32x4 a, f32x4 b) {
+    f32x4 p = _mm_mul_ps(a, b);
+    f32x4 y = _mm_shuffle_ps(p, p, _MM_SHUFFLE(1, 1, 1, 1));
+    f32x4 z = _mm_movehl_ps(p, p);
+    return _mm_cvtss_f32(_mm_add_ss(_mm_add_ss(p, y), z));
+}
+
+inline float max3(f32x4 a) {
+    f32x4 y = _mm_shuffle_ps(a, a, _MM_SHUFFLE(1, 1, 1, 1));
+    f32x4 z = _mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 2, 2, 2));
+    return _mm_cvtss_f32(_mm_max_ss(_mm_max_ss(a, y), z));
+}
+inline float min3(f32x4 a) {
+    f32x4 y = _mm_shuffle_ps(a, a, _MM_SHUFFLE(1, 1, 1, 1));
+    f32x4 z = _mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 2, 2, 2));
+    return _mm_cvtss_f32(_mm_min_ss(_mm_min_ss(a, y), z));
+}
+
+// (y, z, x)
+inline f32x4 rotate(f32x4 a) { return _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1)); }
+
+#elif defined(__ARM_NEON)
+using f32x4 = float32x4_t;
+
+inline f32x4 set(float x, float y, float z) { return float32x4_t { x, y, z, 0 }; }
+inline f32x4 splat(float s) { return vdupq_n_f32(s); }
+
+inline f32x4 add(f32x4 a, f32x4 b) { return vaddq_f32(a, b); }
+inline f32x4 sub(f32x4 a, f32x4 b) { return vsubq_f32(a, b); }
+inline f32x4 mul(f32x4 a, f32x4 b) { return vmulq_f32(a, b); }
+inline f32x4 div(f32x4 a, f32x4 b) { return vdivq_f32(a, b); }
+inline f32x4 min(f32x4 a, f32x4 b) { return vminq_f32(a, b); }
+inline f32x4 max(f32x4 a, f32x4 b) { return vmaxq_f32(a, b); }
+inline f32x4 sqrt(f32x4 a) { return vsqrtq_f32(a); }
+inline f32x4 neg(f32x4 a) { return vnegq_f32(a); }
+
+// The padding lane can hold anything after a division, so it is cleared or
+// replaced before every horizontal reduction
+inline float dot3(f32x4 a, f32x4 b) { return vaddvq_f32(vsetq_lane_f32(0, vmulq_f32(a, b), 3)); }
+inline float max3(f32x4 a) { return vmaxvq_f32(vsetq_lane_f32(vgetq_lane_f32(a, 0), a, 3)); }
+inline float min3(f32x4 a) { return vminvq_f32(vsetq_lane_f32(vgetq_lane_f32(a, 0), a, 3)); }
+
+inline f32x4 rotate(f32x4 a) {
+    return float32x4_t { vgetq_lane_f32(a, 1), vgetq_lane_f32(a, 2), vgetq_lane_f32(a, 0), 0 };
+}
+
+#else
+struct f32x4 { float lane[4]; };
+
+inline f32x4 set(float x, float y, float z) { return f32x4 {{ x, y, z, 0 }}; }
+inline f32x4 splat(float s) { return f32x4 {{ s, s, s, s }}; }
+
+#define VECMATH_LANEWISE(_name, _expr) \
+    inline f32x4 _name(f32x4 a, f32x4 b) { \
+        f32x4 r; \
+        for (int i = 0; i < 4; i++) { float x = a.lane[i], y = b.lane[i]; r.lane[i] = (_expr); } \
+        return r; \
+    }
+VECMATH_LANEWISE(add, x + y)
+VECMATH_LANEWISE(sub, x - y)
+VECMATH_LANEWISE(mul, x * y)
+VECMATH_LANEWISE(div, x / y)
+VECMATH_LANEWISE(min, y < x ? y : x)
+VECMATH_LANEWISE(max, x < y ? y : x)
+#undef VECMATH_LANEWISE
+
+inline f32x4 sqrt(f32x4 a) { return f32x4 {{ std::sqrt(a.lane[0]), std::sqrt(a.lane[1]), std::sqrt(a.lane[2]), 0 }}; }
+inline f32x4 neg(f32x4 a) { return f32x4 {{ -a.lane[0], -a.lane[1], -a.lane[2], -a.lane[3] }}; }
+
+inline float dot3(f32x4 a, f32x4 b) { return a.lane[0] * b.lane[0] + a.lane[1] * b.lane[1] + a.lane[2] * b.lane[2]; }
+inline float max3(f32x4 a) { return std::max(std::max(a.lane[0], a.lane[1]), a.lane[2]); }
+inline float min3(f32x4 a) { return std::min(std::min(a.lane[0], a.lane[1]), a.lane[2]); }
+
+inline f32x4 rotate(f32x4 a) { return f32x4 {{ a.lane[1], a.lane[2], a.lane[0], 0 }}; }
+#endif
+
+template<typename S>
+using if_scalar = std::enable_if_t<std::is_arithmetic<S>::value, int>;
+
+} // namespace detail
+
+struct alignas(16) float3 {
+    union {
+        detail::f32x4 v;
+        float e[4];
+        struct { float x, y, z, w_; };
+    };
+
+    float3() : v(detail::splat(0)) {}
+    float3(detail::f32x4 v) : v(v) {}
+    float3(float x, float y, float z) : v(detail::set(x, y, z)) {}
+
+    float& operator[](int i) { return e[i]; }
+    float operator[](int i) const { return e[i]; }
+
+    float3 operator-() const { return detail::neg(v); }
+
+    float3& operator+=(const float3& o) { v = detail::add(v, o.v); return *this; }
+    float3& operator-=(const float3& o) { v = detail::sub(v, o.v); return *this; }
+    float3& operator*=(const float3& o) { v = detail::mul(v, o.v); return *this; }
+    float3& operator/=(const float3& o) { v = detail::div(v, o.v); return *this; }
+
+    template<typename S, detail::if_scalar<S> = 0>
+    float3& operator*=(S s) { v = detail::mul(v, detail::splat(s)); return *this; }
+    template<typename S, detail::if_scalar<S> = 0>
+    float3& operator/=(S s) { v = detail::div(v, detail::splat(s)); return *this; }
+};
+static_assert(sizeof(float3) == 16, "float3 must keep Apple's padded 16-byte layout");
+
+struct uint3 {
+    unsigned int x, y, z, w_;
+};
+
+template<typename A, typename B, typename C>
+inline float3 make_float3(A x, B y, C z) {
+    return float3(static_cast<float>(x), static_cast<float>(y), static_cast<float>(z));
+}
+
+#define VECMATH_OPERATOR(_op, _fn) \
+    inline float3 operator _op(const float3& a, const float3& b) { return detail::_fn(a.v, b.v); } \
+    template<typename S, detail::if_scalar<S> = 0> \
+    inline float3 operator _op(const float3& a, S s) { return detail::_fn(a.v, detail::splat(s)); } \
+    template<typename S, detail::if_scalar<S> = 0> \
+    inline float3 operator _op(S s, const float3& a) { return detail::_fn(detail::splat(s), a.v); }
+VECMATH_OPERATOR(+, add)
+VECMATH_OPERATOR(-, sub)
+VECMATH_OPERATOR(*, mul)
+VECMATH_OPERATOR(/, div)
+#undef VECMATH_OPERATOR
+
+inline float dot(const float3& a, const float3& b) { return detail::dot3(a.v, b.v); }
+inline float length_squared(const float3& a) { return dot(a, a); }
+inline float length(const float3& a) { return std::sqrt(dot(a, a)); }
+inline float3 normalize(const float3& a) { return a / length(a); }
+inline float3 reflect(const float3& i, const float3& n) { return i - 2 * dot(i, n) * n; }
+
+// a x b = (a * rot(b) - rot(a) * b) rotated once more
+inline float3 cross(const float3& a, const float3& b) {
+    detail::f32x4 c = detail::sub(detail::mul(a.v, detail::rotate(b.v)), detail::mul(detail::rotate(a.v), b.v));
+    return detail::rotate(c);
+}
+
+inline float3 min(const float3& a, const float3& b) { return detail::min(a.v, b.v); }
+inline float3 max(const float3& a, const float3& b) { return detail::max(a.v, b.v); }
+inline float3 clamp(const float3& x, const float3& lo, const float3& hi) { return min(max(x, lo), hi); }
+inline float clamp(float x, float lo, float hi) { return std::min(std::max(x, lo), hi); }
+inline float3 sqrt(const float3& a) { return detail::sqrt(a.v); }
+inline float sqrt(float a) { return std::sqrt(a); }
+inline float recip(float a) { return 1.0f / a; }
+
+inline float reduce_max(const float3& a) { return detail::max3(a.v); }
+inline float reduce_min(const float3& a) { return detail::min3(a.v); }
+
+// Truncates each component into [0, UINT_MAX]
+template<typename T>
+inline uint3 convert_sat(const float3& a) {
+    static_assert(std::is_same<T, unsigned int>::value, "only unsigned int conversions are provided");
+    auto sat = [](float f) -> unsigned int {
+        if (!(f > 0))
+            return 0;
+        return f >= 4294967295.0f ? 4294967295u : static_cast<unsigned int>(f);
+    };
+    return uint3 { sat(a.x), sat(a.y), sat(a.z), 0 };
+}
+
+} // namespace simd
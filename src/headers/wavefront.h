@@ -0,0 +1,35 @@
+#pragma once
+
+#include "hittable.h"
+#include "material.h"
+
+#include <vector>
+
+// One path in flight: the ray it is about to trace, the color it still carries,
+// the pixel it ends up in, its pcg_path_seed and the stream of the current bounce
+struct path_state {
+    ray r;
+    color throughput;
+    uint32_t pixel;
+    simd::uint1 path_seed;
+    simd::uint1 seed;
+};
+
+// Every path of the current bounce, the hit found for each and the same paths
+// bucketed by the type of material they hit. Kept between frames so the
+// buffers are only allocated once.
+struct WavefrontQueues {
+    std::vector<path_state> paths;
+    std::vector<path_state> next_paths;
+    std::vector<hit_record> recs;
+    std::vector<uint32_t> by_material[MATERIAL_TYPE_COUNT];
+
+    void sort_by_material(uint32_t count, const std::vector<material*> &materials);
+};
+
+inline void WavefrontQueues::sort_by_material(uint32_t count, const std::vector<material*> &materials) {
+    for (auto &group : by_material)
+        group.clear();
+    for (uint32_t i = 0; i < count; i++)
+        by_material[static_cast<int>(materials[recs[i].mat_id]->type)].push_back(i);
+}
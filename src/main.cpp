@@ -9,6 +9,9 @@
 #include "headers/camera.h"
 #include "headers/vec3.h"
 #include "headers/material.h"
+#include "headers/wavefront.h"
+#include "headers/tracer.h"
+#include "headers/pipeline.h"
 #include <imgui.h>
 
 // Image Constants
@@ -19,93 +22,6 @@ const int TEX_HEIGHT = static_cast<int>(TEX_WIDTH / TEX_ASPECT);
 void sphere_menu(Scene &scene, Parameters &params, double dt);
 void thread_menu(int thread_count, std::vector<RenderTask> task_collection);
 
-// --------------------------------------PCG-------------------------------------
-color pcg_ray_color(const ray& r, const hittable& world, int depth, uint seed) {
-    hit_record rec;
-    if (depth <= 0)
-        return simd::make_float3(0,0,0);
-
-    if (world.hit(r, 0.001, infinity, rec)) {
-        ray scattered;
-        color attenuation;
-        if (rec.mat->scatter(r, rec, attenuation, scattered, seed)) {
-            return attenuation * pcg_ray_color(scattered, world, depth-1, seed);
-        }
-        return simd::make_float3(0, 0, 0);
-    }
-    vec3 unit_direction = simd::normalize(r.direction());
-    auto t = 0.5*(unit_direction.y + 1.0);
-    return (1.0-t)*simd::make_float3(1.0, 1.0, 1.0) + t*simd::make_float3(0.5, 0.7, 1.0);
-}
-
-void pcg_render(hittable_list& world, camera& cam, Parameters &parameters, RenderTask task) {
-    const int max_depth = 50;
-
-    for (int j = task.start_y; j < task.end_y; j++) {
-        for (int i = task.start_x; i < task.end_x; i++) {
-            color pixel_color = simd::make_float3(0, 0, 0);
-            simd::uint1 pixel_coord = (j * TEX_WIDTH-1) + i;
-            for (int s = 0; s < parameters.samples_per_pixel; ++s) {
-                auto u = (i + pcg_random_float(pixel_coord)) / (TEX_WIDTH-1);
-                auto v = (j + pcg_random_float(pixel_coord)) / (TEX_HEIGHT-1);
-                ray r = cam.get_ray(u, v);
-                pixel_color += pcg_ray_color(r, world, max_depth, pixel_coord);
-            }
-            parameters.color_buffer[j * parameters.tex_width + i] = pixel_color;
-        }
-    }
-}
-// -----------------------------------------------------------------------------
-color ray_color(const ray& r, const hittable& world, int depth) {
-    hit_record rec;
-    if (depth <= 0)
-        return simd::make_float3(0, 0, 0);
-
-    if (world.hit(r, 0.001, infinity, rec)) {
-        ray scattered;
-        color attenuation;
-        if (rec.mat->scatter(r, rec, attenuation, scattered)) {
-            return attenuation * ray_color(scattered, world, depth-1);
-        }
-        return simd::make_float3(0, 0, 0);
-    }
-
-    vec3 unit_direction = simd::normalize(r.direction());
-    auto t = 0.5*(unit_direction.y + 1.0);
-    return (1.0-t)*simd::make_float3(1.0, 1.0, 1.0) + t*simd::make_float3(0.5, 0.7, 1.0);
-}
-
-void render(hittable_list& world, camera& cam, Parameters& parameters, RenderTask task) {
-
-    const int max_depth = 10;
-
-    for (int j = task.start_y; j < task.end_y; j++) {
-        for (int i = task.start_x; i < task.end_x; i++) {
-            color pixel_color = simd::make_float3(0, 0, 0);;
-            for (int s = 0; s < parameters.samples_per_pixel; ++s) {
-                auto u = (i + random_float()) / (TEX_WIDTH-1);
-                auto v = (j + random_float()) / (TEX_HEIGHT-1);
-                ray r = cam.get_ray(u, v);
-                pixel_color += ray_color(r, world, max_depth);
-            }
-            parameters.color_buffer[j * parameters.tex_width + i] = pixel_color;
-        }
-    }
-}
-// -----------------------------------------------------------------------------
-
-void thread_render(ThreadManager &threads, hittable_list &world, camera &cam, Parameters &params) {
-    while (true) {
-        RenderTask task;
-        threads.task_queue.wait_and_pop(task);
-
-        pcg_render(world, cam, params, task);
-
-        threads.completion_queue.push(task);
-    }
-}
-
-
 int main() {
 
     // Renderer
@@ -115,14 +31,24 @@ int main() {
     Parameters parameters(TEX_WIDTH, TEX_HEIGHT);
     parameters.render_type = 2;
 
+    // Binds the SIMD kernels for this CPU now so the choice is logged at startup
+    kernels();
+
     Scene scene;
     scene.init_scene1();
 
     // Camera 
     camera cam(TEX_ASPECT);
 
-    ThreadManager threads(TEX_WIDTH, TEX_HEIGHT);
-    threads.threads_init(thread_render, std::ref(threads), std::ref(scene.world), std::ref(cam), std::ref(parameters));
+    // The multi-threaded mode renders copies of the scene, taken whenever it changes.
+    // Each of these owns a full pool of worker threads, so only the one the current
+    // mode uses is alive.
+    std::unique_ptr<FramePipeline> pipeline;
+    std::unique_ptr<ContinuousTracer> tracer;
+    SnapshotPool snapshots;
+    shared_ptr<Scene> snapshot;
+    uint64_t generation = 0;
+    const TracedFrame *traced = nullptr;
 
     auto time = NOW();
 
@@ -131,42 +57,126 @@ int main() {
         double dt = GET_TIME(NOW(), time);
         time = NOW();
 
-        handle_inputs(renderer.input(), std::static_pointer_cast<sphere>(scene.controlled), parameters, dt);
+        if (handle_inputs(renderer.input(), std::static_pointer_cast<sphere>(scene.controlled), parameters, dt)) {
+            scene.world.refit(scene.controlled.get());
+            parameters.scene_changed = true;
+        }
+        if (parameters.scene_changed) {
+            snapshot.reset();
+            generation++;
+        }
+        if (parameters.scene_changed || !parameters.accumulate) {
+            parameters.accumulated_frames = 0;
+            parameters.accumulated_samples = 0;
+            parameters.scene_changed = false;
+        }
 
         renderer.begin_new_frame();
+        parameters.ray_stats.reset();
 
+        // Latched so toggling it in the menu cannot leave the texture locked. A
+        // pipelined frame that is shown late, or one handed over by the decoupled
+        // tracer, goes through their own buffers.
+        bool pipelined = parameters.render_type < 1 || parameters.render_type > 3;
+        bool decoupled = pipelined && parameters.decoupled;
+
+        if (!decoupled) {
+            traced = nullptr;
+            tracer.reset();
+        }
+        if (!pipelined || decoupled)
+            pipeline.reset();
+
+        // A new pool starts from an empty accumulation buffer
+        if ((decoupled && !tracer) || (pipelined && !decoupled && !pipeline)) {
+            parameters.accumulated_frames = 0;
+            parameters.accumulated_samples = 0;
+            if (decoupled) {
+                tracer = std::make_unique<ContinuousTracer>(TEX_WIDTH, TEX_HEIGHT);
+                tracer->set_running(true);
+            } else {
+                pipeline = std::make_unique<FramePipeline>(TEX_WIDTH, TEX_HEIGHT);
+            }
+        }
+        if (pipeline && parameters.frame_latency != pipeline->latency())
+            pipeline->set_latency(parameters.frame_latency);
+
+        bool zero_copy = parameters.zero_copy && !decoupled && !(pipeline && pipeline->latency() > 1);
+        const uint *fresh = nullptr;
+        if (zero_copy) {
+            parameters.pack_target = renderer.lock_texture(parameters.pack_pitch);
+        } else {
+            parameters.pack_target = parameters.buffer;
+            parameters.pack_pitch = TEX_WIDTH;
+        }
+
+        RenderTask frame {
+            .start_x = 0,
+            .start_y = 0,
+            .end_x = TEX_WIDTH,
+            .end_y = (uint)TEX_HEIGHT,
+        };
+
+        // The pipeline's workers resolve their own tiles; the other modes resolve the
+        // whole frame once it is rendered
         switch (parameters.render_type) {
             case 1: {
-                render(scene.world, cam, parameters, RenderTask {
-                    .start_x = 0,
-                    .start_y = 0,
-                    .end_x = TEX_WIDTH,
-                    .end_y = (uint)TEX_HEIGHT,
-                });
+                render(scene, cam, parameters, frame);
+                resolve_tile(parameters, frame);
                 break;
             }
             case 2: {
-                pcg_render(scene.world, cam, parameters, RenderTask {
-                    .start_x = 0,
-                    .start_y = 0,
-                    .end_x = TEX_WIDTH,
-                    .end_y = (uint)TEX_HEIGHT,
-                });
+                pcg_render(scene, cam, parameters, frame);
+                resolve_tile(parameters, frame);
+                break;
+            }
+            case 3: {
+                wavefront_render(scene, cam, parameters, frame);
+                resolve_tile(parameters, frame);
                 break;
             }
             default: {
-                threads.push_tasks();
+                if (!snapshot)
+                    snapshot = snapshots.acquire(scene);
+                if (decoupled) {
+                    tracer->submit(snapshot, cam, parameters, generation);
+                    if (const TracedFrame *frame = tracer->latest()) {
+                        traced = frame;
+                        fresh = frame->pixels.get();
+                    }
+                    break;
+                }
+                const FrameSlot *shown = pipeline->advance(snapshot, cam, parameters,
+                    zero_copy ? parameters.pack_target : nullptr, parameters.pack_pitch);
+                if (shown) {
+                    fresh = shown->packed;
+                    parameters.ray_stats.assign(shown->ray_stats);
+                }
             }
         }
 
-       if (parameters.render_type != 1 && parameters.render_type != 2)
-            threads.wait_for_completion();
+        parameters.accumulated_frames++;
+        parameters.accumulated_samples += parameters.samples_per_pixel;
+        if (traced) {
+            parameters.accumulated_samples = traced->accumulated_samples;
+            parameters.traced_ms = traced->frame_ms;
+            parameters.ray_stats.assign(traced->ray_stats);
+        }
 
         sphere_menu(scene, parameters, dt);
-        thread_menu(threads.thread_count, threads.task_collection);
-
-        fast_color_pack(parameters.color_buffer, parameters.buffer, parameters.samples_per_pixel, TEX_WIDTH * TEX_HEIGHT);
-        renderer.set_buffer(parameters.buffer);
+        if (pipeline)
+            thread_menu(pipeline->threads.thread_count, pipeline->threads.task_collection);
+        else if (tracer)
+            thread_menu(tracer->threads.thread_count, tracer->threads.task_collection);
+
+        if (zero_copy)
+            renderer.unlock_texture();
+        else if (fresh)
+            renderer.upload(fresh);
+        else if (pipelined)
+            renderer.keep_texture();
+        else
+            renderer.set_buffer(parameters.buffer);
         renderer.present();
     }
   
@@ -184,24 +194,75 @@ void sphere_menu(Scene &scene, Parameters &params, double dt) {
     ImGui::Text("%.2f FPS", 1 / dt);
     if (ImGui::Button("multi")) {
         params.render_type = 0;
+        params.scene_changed = true;
     }
     ImGui::SameLine();
     if (ImGui::Button("regular")) {
         params.render_type = 1;
+        params.scene_changed = true;
     }
     ImGui::SameLine();
     if (ImGui::Button("PCG")) {
         params.render_type = 2;
+        params.scene_changed = true;
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("wavefront")) {
+        params.render_type = 3;
+        params.scene_changed = true;
     }
     ImGui::SameLine();
     if (params.render_type == 1) {
         ImGui::Text("Default Render");
     } else if (params.render_type == 2) {
         ImGui::Text("PCG Renderer");
+    } else if (params.render_type == 3) {
+        ImGui::Text("Wavefront");
     } else {
         ImGui::Text("Multi-threaded");
     }
 
+    if (ImGui::SliderInt("max depth", &params.max_depth, 1, 100))
+        params.scene_changed = true;
+    if (ImGui::SliderInt("roulette from", &params.rr_depth, 1, params.max_depth))
+        params.scene_changed = true;
+    if (params.render_type != 3) {
+        static const char *samplers[SAMPLER_TYPE_COUNT] = {
+            sampler_name(sampler_type::white), sampler_name(sampler_type::sobol),
+            sampler_name(sampler_type::lattice), sampler_name(sampler_type::blue_noise),
+        };
+        int sampler = static_cast<int>(params.sampler);
+        if (ImGui::Combo("sampler", &sampler, samplers, SAMPLER_TYPE_COUNT)) {
+            prepare_sampler(static_cast<sampler_type>(sampler));
+            params.sampler = static_cast<sampler_type>(sampler);
+            params.scene_changed = true;
+        }
+    }
+    ImGui::Checkbox("accumulate", &params.accumulate);
+    ImGui::SameLine();
+    ImGui::Text("%d spp", params.accumulated_samples);
+    ImGui::Checkbox("streaming pack", &params.stream_pack);
+    ImGui::SameLine();
+    ImGui::Checkbox("zero-copy present", &params.zero_copy);
+    if (params.render_type < 1 || params.render_type > 3) {
+        ImGui::Checkbox("decoupled tracer", &params.decoupled);
+        if (params.decoupled)
+            ImGui::Text("Tracer: %.2f ms/frame", params.traced_ms);
+        else
+            ImGui::SliderInt("frame latency", &params.frame_latency, 1, MAX_FRAME_LATENCY);
+    }
+
+    const RayStats &stats = params.ray_stats;
+    ImGui::Text("Average path length: %.2f rays", stats.average_path_length());
+    if (params.render_type != 1) {
+        if (params.render_type != 3)
+            ImGui::Checkbox("primary ray packets", &params.packet_primary);
+        if (stats.primary_ns > 0)
+            ImGui::Text("Primary:   %.2f Mrays/s per thread", stats.primary_rays * 1e3 / stats.primary_ns);
+        if (stats.secondary_ns > 0)
+            ImGui::Text("Secondary: %.2f Mrays/s per thread", stats.secondary_rays * 1e3 / stats.secondary_ns);
+    }
+
     if (ImGui::Button("toggle sphere")) {
         sphere_toggle = (sphere_toggle + 1) % scene.world.objects.size();
         std::cout << sphere_toggle << std::endl;
@@ -222,9 +283,11 @@ void sphere_menu(Scene &scene, Parameters &params, double dt) {
             );
             ImGui::Text(
                 "Color:\n r: %.2f, g: %.2f, b: %.2f", 
-                s->mat->get_color().x, s->mat->get_color().y, s->mat->get_color().z
+                scene.get_material(s->mat_id)->get_color().x,
+                scene.get_material(s->mat_id)->get_color().y,
+                scene.get_material(s->mat_id)->get_color().z
             );
-            ImGui::Text("Material:\n %s", s->mat->type_name());
+            ImGui::Text("Material:\n %s", scene.get_material(s->mat_id)->type_name());
 
             if (ImGui::Button("color")) {
                 color_toggle *= -1;
@@ -232,19 +295,28 @@ void sphere_menu(Scene &scene, Parameters &params, double dt) {
             ImGui::SameLine();
             if (ImGui::Button("delete")) {
                 scene.world.objects.erase(scene.world.objects.begin() + i);
+                scene.world.build_bvh();
+                params.scene_changed = true;
+                break;
             }
             ImGui::SameLine();
             if (ImGui::Button("metal")) {
-                s->mat = make_shared<metal>(simd::make_float3(0.3, 0.3, 0.3));
+                scene.replace_material(*s, make_shared<metal>(simd::make_float3(0.3, 0.3, 0.3)));
+                params.scene_changed = true;
             }
             ImGui::SameLine();
             if (ImGui::Button("lambertian")) {
-                s->mat = make_shared<lambertian>(simd::make_float3(0.3, 0.3, 0.3));
+                scene.replace_material(*s, make_shared<lambertian>(simd::make_float3(0.3, 0.3, 0.3)));
+                params.scene_changed = true;
             }
 
             if (color_toggle == 1) {
                 ImGui::ColorPicker3("Sphere Color", col);
-                s->mat->set_color(simd::make_float3(col[0], col[1], col[2]));
+                color current = scene.get_material(s->mat_id)->get_color();
+                if (current.x != col[0] || current.y != col[1] || current.z != col[2]) {
+                    scene.get_material(s->mat_id)->set_color(simd::make_float3(col[0], col[1], col[2]));
+                    params.scene_changed = true;
+                }
             }
         }
 
@@ -252,8 +324,10 @@ void sphere_menu(Scene &scene, Parameters &params, double dt) {
     }
 
     if (ImGui::Button("New Sphere")) {
-        auto material_center = make_shared<lambertian>(simd::make_float3(0.5, 0.5, 0.5));
+        uint32_t material_center = scene.add_material(make_shared<lambertian>(simd::make_float3(0.5, 0.5, 0.5)));
         scene.world.add(make_shared<sphere>(simd::make_float3(0.0, 0.0, -1.2), 0.5, material_center));
+        scene.world.build_bvh();
+        params.scene_changed = true;
     }
     ImGui::End();
 }